@@ -36,115 +36,435 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// rcpp_cluster_patterns
+Rcpp::List rcpp_cluster_patterns(Rcpp::RawVector& packed, const int npat, const int npos, std::vector<double> weight, const int k, const int max_iter, const int seed, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_cluster_patterns(SEXP packedSEXP, SEXP npatSEXP, SEXP nposSEXP, SEXP weightSEXP, SEXP kSEXP, SEXP max_iterSEXP, SEXP seedSEXP, SEXP nthreadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::RawVector& >::type packed(packedSEXP);
+    Rcpp::traits::input_parameter< const int >::type npat(npatSEXP);
+    Rcpp::traits::input_parameter< const int >::type npos(nposSEXP);
+    Rcpp::traits::input_parameter< std::vector<double> >::type weight(weightSEXP);
+    Rcpp::traits::input_parameter< const int >::type k(kSEXP);
+    Rcpp::traits::input_parameter< const int >::type max_iter(max_iterSEXP);
+    Rcpp::traits::input_parameter< const int >::type seed(seedSEXP);
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_cluster_patterns(packed, npat, npos, weight, k, max_iter, seed, nthreads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_cx_acc_create
+Rcpp::List rcpp_cx_acc_create();
+RcppExport SEXP _epialleleR_rcpp_cx_acc_create() {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    rcpp_result_gen = Rcpp::wrap(rcpp_cx_acc_create());
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_cx_acc_add
+Rcpp::List rcpp_cx_acc_add(Rcpp::List& acc, Rcpp::DataFrame& df, Rcpp::LogicalVector& pass);
+RcppExport SEXP _epialleleR_rcpp_cx_acc_add(SEXP accSEXP, SEXP dfSEXP, SEXP passSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List& >::type acc(accSEXP);
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
+    Rcpp::traits::input_parameter< Rcpp::LogicalVector& >::type pass(passSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_cx_acc_add(acc, df, pass));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_cx_acc_merge
+Rcpp::List rcpp_cx_acc_merge(Rcpp::List& accs);
+RcppExport SEXP _epialleleR_rcpp_cx_acc_merge(SEXP accsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List& >::type accs(accsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_cx_acc_merge(accs));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_cx_acc_save
+double rcpp_cx_acc_save(Rcpp::List& acc, std::string fn);
+RcppExport SEXP _epialleleR_rcpp_cx_acc_save(SEXP accSEXP, SEXP fnSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List& >::type acc(accSEXP);
+    Rcpp::traits::input_parameter< std::string >::type fn(fnSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_cx_acc_save(acc, fn));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_cx_acc_load
+Rcpp::List rcpp_cx_acc_load(std::string fn);
+RcppExport SEXP _epialleleR_rcpp_cx_acc_load(SEXP fnSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type fn(fnSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_cx_acc_load(fn));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_cx_acc_report
+Rcpp::DataFrame rcpp_cx_acc_report(Rcpp::List& acc, const std::string ctx, const bool merge_strands);
+RcppExport SEXP _epialleleR_rcpp_cx_acc_report(SEXP accSEXP, SEXP ctxSEXP, SEXP merge_strandsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List& >::type acc(accSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< const bool >::type merge_strands(merge_strandsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_cx_acc_report(acc, ctx, merge_strands));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_cx_matrix
+Rcpp::List rcpp_cx_matrix(Rcpp::List& dfs, Rcpp::List& passes, const std::string ctx, const int min_coverage, const int min_samples);
+RcppExport SEXP _epialleleR_rcpp_cx_matrix(SEXP dfsSEXP, SEXP passesSEXP, SEXP ctxSEXP, SEXP min_coverageSEXP, SEXP min_samplesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::List& >::type dfs(dfsSEXP);
+    Rcpp::traits::input_parameter< Rcpp::List& >::type passes(passesSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< const int >::type min_coverage(min_coverageSEXP);
+    Rcpp::traits::input_parameter< const int >::type min_samples(min_samplesSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_cx_matrix(dfs, passes, ctx, min_coverage, min_samples));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_cx_mhl_report
+Rcpp::List rcpp_cx_mhl_report(Rcpp::DataFrame& df, Rcpp::LogicalVector& pass, const std::string cx_ctx, const std::string mhl_ctx, const int hmax, const int hmin, const double max_ooctx_meth_frac, const bool merge_strands);
+RcppExport SEXP _epialleleR_rcpp_cx_mhl_report(SEXP dfSEXP, SEXP passSEXP, SEXP cx_ctxSEXP, SEXP mhl_ctxSEXP, SEXP hmaxSEXP, SEXP hminSEXP, SEXP max_ooctx_meth_fracSEXP, SEXP merge_strandsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
+    Rcpp::traits::input_parameter< Rcpp::LogicalVector& >::type pass(passSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type cx_ctx(cx_ctxSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type mhl_ctx(mhl_ctxSEXP);
+    Rcpp::traits::input_parameter< const int >::type hmax(hmaxSEXP);
+    Rcpp::traits::input_parameter< const int >::type hmin(hminSEXP);
+    Rcpp::traits::input_parameter< const double >::type max_ooctx_meth_frac(max_ooctx_meth_fracSEXP);
+    Rcpp::traits::input_parameter< const bool >::type merge_strands(merge_strandsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_cx_mhl_report(df, pass, cx_ctx, mhl_ctx, hmax, hmin, max_ooctx_meth_frac, merge_strands));
+    return rcpp_result_gen;
+END_RCPP
+}
 // rcpp_cx_report
-Rcpp::DataFrame rcpp_cx_report(Rcpp::DataFrame& df, Rcpp::LogicalVector& pass, const std::string ctx);
-RcppExport SEXP _epialleleR_rcpp_cx_report(SEXP dfSEXP, SEXP passSEXP, SEXP ctxSEXP) {
+Rcpp::DataFrame rcpp_cx_report(Rcpp::DataFrame& df, Rcpp::LogicalVector& pass, const std::string ctx, const bool merge_strands);
+RcppExport SEXP _epialleleR_rcpp_cx_report(SEXP dfSEXP, SEXP passSEXP, SEXP ctxSEXP, SEXP merge_strandsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
     Rcpp::traits::input_parameter< Rcpp::LogicalVector& >::type pass(passSEXP);
     Rcpp::traits::input_parameter< const std::string >::type ctx(ctxSEXP);
-    rcpp_result_gen = Rcpp::wrap(rcpp_cx_report(df, pass, ctx));
+    Rcpp::traits::input_parameter< const bool >::type merge_strands(merge_strandsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_cx_report(df, pass, ctx, merge_strands));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_cx_track
+Rcpp::NumericVector rcpp_cx_track(Rcpp::DataFrame& df, Rcpp::LogicalVector& pass, const std::string ctx, const bool merge_strands, const int min_coverage, const std::string bedgraph_fn, const std::string coverage_fn, const std::string track_fn);
+RcppExport SEXP _epialleleR_rcpp_cx_track(SEXP dfSEXP, SEXP passSEXP, SEXP ctxSEXP, SEXP merge_strandsSEXP, SEXP min_coverageSEXP, SEXP bedgraph_fnSEXP, SEXP coverage_fnSEXP, SEXP track_fnSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
+    Rcpp::traits::input_parameter< Rcpp::LogicalVector& >::type pass(passSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< const bool >::type merge_strands(merge_strandsSEXP);
+    Rcpp::traits::input_parameter< const int >::type min_coverage(min_coverageSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type bedgraph_fn(bedgraph_fnSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type coverage_fn(coverage_fnSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type track_fn(track_fnSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_cx_track(df, pass, ctx, merge_strands, min_coverage, bedgraph_fn, coverage_fn, track_fn));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_read_track
+Rcpp::DataFrame rcpp_read_track(std::string fn, std::string region_rname, int region_start, int region_end);
+RcppExport SEXP _epialleleR_rcpp_read_track(SEXP fnSEXP, SEXP region_rnameSEXP, SEXP region_startSEXP, SEXP region_endSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type fn(fnSEXP);
+    Rcpp::traits::input_parameter< std::string >::type region_rname(region_rnameSEXP);
+    Rcpp::traits::input_parameter< int >::type region_start(region_startSEXP);
+    Rcpp::traits::input_parameter< int >::type region_end(region_endSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_read_track(fn, region_rname, region_start, region_end));
     return rcpp_result_gen;
 END_RCPP
 }
 // rcpp_extract_patterns
-Rcpp::DataFrame rcpp_extract_patterns(Rcpp::DataFrame& df, const unsigned int target_rname, const unsigned int target_start, const unsigned int target_end, const signed int min_overlap, const std::string ctx, const double min_ctx_freq, const bool clip, const unsigned int reverse_offset, Rcpp::IntegerVector& hlght);
-RcppExport SEXP _epialleleR_rcpp_extract_patterns(SEXP dfSEXP, SEXP target_rnameSEXP, SEXP target_startSEXP, SEXP target_endSEXP, SEXP min_overlapSEXP, SEXP ctxSEXP, SEXP min_ctx_freqSEXP, SEXP clipSEXP, SEXP reverse_offsetSEXP, SEXP hlghtSEXP) {
+Rcpp::List rcpp_extract_patterns(Rcpp::DataFrame& df, std::vector<int> target_rname, std::vector<int> target_start, std::vector<int> target_end, const signed int min_overlap, const std::string ctx, const double min_ctx_freq, const bool clip, const unsigned int reverse_offset, Rcpp::List& hlght, const bool summarize, const bool pack, int nthreads);
+RcppExport SEXP _epialleleR_rcpp_extract_patterns(SEXP dfSEXP, SEXP target_rnameSEXP, SEXP target_startSEXP, SEXP target_endSEXP, SEXP min_overlapSEXP, SEXP ctxSEXP, SEXP min_ctx_freqSEXP, SEXP clipSEXP, SEXP reverse_offsetSEXP, SEXP hlghtSEXP, SEXP summarizeSEXP, SEXP packSEXP, SEXP nthreadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
-    Rcpp::traits::input_parameter< const unsigned int >::type target_rname(target_rnameSEXP);
-    Rcpp::traits::input_parameter< const unsigned int >::type target_start(target_startSEXP);
-    Rcpp::traits::input_parameter< const unsigned int >::type target_end(target_endSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type target_rname(target_rnameSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type target_start(target_startSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type target_end(target_endSEXP);
     Rcpp::traits::input_parameter< const signed int >::type min_overlap(min_overlapSEXP);
     Rcpp::traits::input_parameter< const std::string >::type ctx(ctxSEXP);
     Rcpp::traits::input_parameter< const double >::type min_ctx_freq(min_ctx_freqSEXP);
     Rcpp::traits::input_parameter< const bool >::type clip(clipSEXP);
     Rcpp::traits::input_parameter< const unsigned int >::type reverse_offset(reverse_offsetSEXP);
-    Rcpp::traits::input_parameter< Rcpp::IntegerVector& >::type hlght(hlghtSEXP);
-    rcpp_result_gen = Rcpp::wrap(rcpp_extract_patterns(df, target_rname, target_start, target_end, min_overlap, ctx, min_ctx_freq, clip, reverse_offset, hlght));
+    Rcpp::traits::input_parameter< Rcpp::List& >::type hlght(hlghtSEXP);
+    Rcpp::traits::input_parameter< const bool >::type summarize(summarizeSEXP);
+    Rcpp::traits::input_parameter< const bool >::type pack(packSEXP);
+    Rcpp::traits::input_parameter< int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_extract_patterns(df, target_rname, target_start, target_end, min_overlap, ctx, min_ctx_freq, clip, reverse_offset, hlght, summarize, pack, nthreads));
     return rcpp_result_gen;
 END_RCPP
 }
 // rcpp_fep
-std::vector<double> rcpp_fep(Rcpp::DataFrame& df, std::vector<std::string> colnames);
-RcppExport SEXP _epialleleR_rcpp_fep(SEXP dfSEXP, SEXP colnamesSEXP) {
+Rcpp::List rcpp_fep(Rcpp::DataFrame& df, std::vector<std::string> colnames, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_fep(SEXP dfSEXP, SEXP colnamesSEXP, SEXP nthreadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
     Rcpp::traits::input_parameter< std::vector<std::string> >::type colnames(colnamesSEXP);
-    rcpp_result_gen = Rcpp::wrap(rcpp_fep(df, colnames));
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_fep(df, colnames, nthreads));
     return rcpp_result_gen;
 END_RCPP
 }
 // rcpp_get_base_freqs
-Rcpp::NumericMatrix rcpp_get_base_freqs(Rcpp::DataFrame& df, std::vector<bool> pass, Rcpp::DataFrame& vcf);
-RcppExport SEXP _epialleleR_rcpp_get_base_freqs(SEXP dfSEXP, SEXP passSEXP, SEXP vcfSEXP) {
+Rcpp::NumericMatrix rcpp_get_base_freqs(Rcpp::DataFrame& df, Rcpp::LogicalVector& pass, Rcpp::DataFrame& vcf, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_get_base_freqs(SEXP dfSEXP, SEXP passSEXP, SEXP vcfSEXP, SEXP nthreadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
+    Rcpp::traits::input_parameter< Rcpp::LogicalVector& >::type pass(passSEXP);
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type vcf(vcfSEXP);
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_get_base_freqs(df, pass, vcf, nthreads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_get_allele_freqs
+Rcpp::List rcpp_get_allele_freqs(Rcpp::DataFrame& df, Rcpp::LogicalVector& pass, Rcpp::DataFrame& vcf, std::vector<std::string> ref, std::vector<std::string> alt, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_get_allele_freqs(SEXP dfSEXP, SEXP passSEXP, SEXP vcfSEXP, SEXP refSEXP, SEXP altSEXP, SEXP nthreadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
-    Rcpp::traits::input_parameter< std::vector<bool> >::type pass(passSEXP);
+    Rcpp::traits::input_parameter< Rcpp::LogicalVector& >::type pass(passSEXP);
     Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type vcf(vcfSEXP);
-    rcpp_result_gen = Rcpp::wrap(rcpp_get_base_freqs(df, pass, vcf));
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type ref(refSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type alt(altSEXP);
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_get_allele_freqs(df, pass, vcf, ref, alt, nthreads));
     return rcpp_result_gen;
 END_RCPP
 }
 // rcpp_get_xm_beta
-std::vector<double> rcpp_get_xm_beta(Rcpp::DataFrame& df, const std::string ctx_meth, const std::string ctx_unmeth);
-RcppExport SEXP _epialleleR_rcpp_get_xm_beta(SEXP dfSEXP, SEXP ctx_methSEXP, SEXP ctx_unmethSEXP) {
+std::vector<double> rcpp_get_xm_beta(Rcpp::DataFrame& df, const std::string ctx_meth, const std::string ctx_unmeth, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_get_xm_beta(SEXP dfSEXP, SEXP ctx_methSEXP, SEXP ctx_unmethSEXP, SEXP nthreadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
     Rcpp::traits::input_parameter< const std::string >::type ctx_meth(ctx_methSEXP);
     Rcpp::traits::input_parameter< const std::string >::type ctx_unmeth(ctx_unmethSEXP);
-    rcpp_result_gen = Rcpp::wrap(rcpp_get_xm_beta(df, ctx_meth, ctx_unmeth));
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_get_xm_beta(df, ctx_meth, ctx_unmeth, nthreads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_get_bed_ecdf
+Rcpp::List rcpp_get_bed_ecdf(Rcpp::DataFrame& df, Rcpp::IntegerVector& read, Rcpp::IntegerVector& bedmatch, Rcpp::IntegerVector& rows, const std::string ctx_meth, const std::string ctx_unmeth, const std::string ooctx_meth, const std::string ooctx_unmeth, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_get_bed_ecdf(SEXP dfSEXP, SEXP readSEXP, SEXP bedmatchSEXP, SEXP rowsSEXP, SEXP ctx_methSEXP, SEXP ctx_unmethSEXP, SEXP ooctx_methSEXP, SEXP ooctx_unmethSEXP, SEXP nthreadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector& >::type read(readSEXP);
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector& >::type bedmatch(bedmatchSEXP);
+    Rcpp::traits::input_parameter< Rcpp::IntegerVector& >::type rows(rowsSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ctx_meth(ctx_methSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ctx_unmeth(ctx_unmethSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ooctx_meth(ooctx_methSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ooctx_unmeth(ooctx_unmethSEXP);
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_get_bed_ecdf(df, read, bedmatch, rows, ctx_meth, ctx_unmeth, ooctx_meth, ooctx_unmeth, nthreads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_heterogeneity_report
+Rcpp::DataFrame rcpp_heterogeneity_report(Rcpp::DataFrame& df, const std::string ctx, const int min_length, const double max_ooctx_meth_frac, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_heterogeneity_report(SEXP dfSEXP, SEXP ctxSEXP, SEXP min_lengthSEXP, SEXP max_ooctx_meth_fracSEXP, SEXP nthreadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< const int >::type min_length(min_lengthSEXP);
+    Rcpp::traits::input_parameter< const double >::type max_ooctx_meth_frac(max_ooctx_meth_fracSEXP);
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_heterogeneity_report(df, ctx, min_length, max_ooctx_meth_frac, nthreads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_heterogeneity_bed_report
+Rcpp::DataFrame rcpp_heterogeneity_bed_report(Rcpp::DataFrame& df, Rcpp::DataFrame& bed, const std::string ctx, const int min_length, const double max_ooctx_meth_frac, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_heterogeneity_bed_report(SEXP dfSEXP, SEXP bedSEXP, SEXP ctxSEXP, SEXP min_lengthSEXP, SEXP max_ooctx_meth_fracSEXP, SEXP nthreadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type bed(bedSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< const int >::type min_length(min_lengthSEXP);
+    Rcpp::traits::input_parameter< const double >::type max_ooctx_meth_frac(max_ooctx_meth_fracSEXP);
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_heterogeneity_bed_report(df, bed, ctx, min_length, max_ooctx_meth_frac, nthreads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_linkage
+Rcpp::List rcpp_linkage(Rcpp::DataFrame& df, std::vector<int> target_rname, std::vector<int> target_start, std::vector<int> target_end, const signed int min_overlap, const std::string ctx, const unsigned int reverse_offset, const unsigned int max_distance, const unsigned int min_coverage, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_linkage(SEXP dfSEXP, SEXP target_rnameSEXP, SEXP target_startSEXP, SEXP target_endSEXP, SEXP min_overlapSEXP, SEXP ctxSEXP, SEXP reverse_offsetSEXP, SEXP max_distanceSEXP, SEXP min_coverageSEXP, SEXP nthreadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type target_rname(target_rnameSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type target_start(target_startSEXP);
+    Rcpp::traits::input_parameter< std::vector<int> >::type target_end(target_endSEXP);
+    Rcpp::traits::input_parameter< const signed int >::type min_overlap(min_overlapSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< const unsigned int >::type reverse_offset(reverse_offsetSEXP);
+    Rcpp::traits::input_parameter< const unsigned int >::type max_distance(max_distanceSEXP);
+    Rcpp::traits::input_parameter< const unsigned int >::type min_coverage(min_coverageSEXP);
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_linkage(df, target_rname, target_start, target_end, min_overlap, ctx, reverse_offset, max_distance, min_coverage, nthreads));
     return rcpp_result_gen;
 END_RCPP
 }
 // rcpp_match_amplicon
-std::vector<int> rcpp_match_amplicon(Rcpp::DataFrame& df, Rcpp::DataFrame& bed, const int tolerance);
-RcppExport SEXP _epialleleR_rcpp_match_amplicon(SEXP dfSEXP, SEXP bedSEXP, SEXP toleranceSEXP) {
+std::vector<int> rcpp_match_amplicon(Rcpp::DataFrame& df, Rcpp::DataFrame& bed, const int tolerance, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_match_amplicon(SEXP dfSEXP, SEXP bedSEXP, SEXP toleranceSEXP, SEXP nthreadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type bed(bedSEXP);
+    Rcpp::traits::input_parameter< const int >::type tolerance(toleranceSEXP);
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_match_amplicon(df, bed, tolerance, nthreads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_match_amplicon_all
+Rcpp::List rcpp_match_amplicon_all(Rcpp::DataFrame& df, Rcpp::DataFrame& bed, const int tolerance, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_match_amplicon_all(SEXP dfSEXP, SEXP bedSEXP, SEXP toleranceSEXP, SEXP nthreadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
     Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type bed(bedSEXP);
     Rcpp::traits::input_parameter< const int >::type tolerance(toleranceSEXP);
-    rcpp_result_gen = Rcpp::wrap(rcpp_match_amplicon(df, bed, tolerance));
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_match_amplicon_all(df, bed, tolerance, nthreads));
     return rcpp_result_gen;
 END_RCPP
 }
 // rcpp_match_capture
-std::vector<int> rcpp_match_capture(Rcpp::DataFrame& df, Rcpp::DataFrame& bed, const signed int min_overlap);
-RcppExport SEXP _epialleleR_rcpp_match_capture(SEXP dfSEXP, SEXP bedSEXP, SEXP min_overlapSEXP) {
+std::vector<int> rcpp_match_capture(Rcpp::DataFrame& df, Rcpp::DataFrame& bed, const signed int min_overlap, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_match_capture(SEXP dfSEXP, SEXP bedSEXP, SEXP min_overlapSEXP, SEXP nthreadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
     Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type bed(bedSEXP);
     Rcpp::traits::input_parameter< const signed int >::type min_overlap(min_overlapSEXP);
-    rcpp_result_gen = Rcpp::wrap(rcpp_match_capture(df, bed, min_overlap));
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_match_capture(df, bed, min_overlap, nthreads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_match_capture_all
+Rcpp::List rcpp_match_capture_all(Rcpp::DataFrame& df, Rcpp::DataFrame& bed, const signed int min_overlap, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_match_capture_all(SEXP dfSEXP, SEXP bedSEXP, SEXP min_overlapSEXP, SEXP nthreadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type bed(bedSEXP);
+    Rcpp::traits::input_parameter< const signed int >::type min_overlap(min_overlapSEXP);
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_match_capture_all(df, bed, min_overlap, nthreads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_bed_report
+Rcpp::List rcpp_bed_report(Rcpp::DataFrame& df, Rcpp::DataFrame& bed, const std::string bed_type, const int tolerance, const signed int min_overlap, const bool match_all, const bool threshold, const std::string ctx_meth, const std::string ctx_unmeth, const std::string ooctx_meth, const std::string ooctx_unmeth, const std::vector<unsigned int> min_n_ctx, const std::vector<double> min_ctx_meth_frac, const std::vector<double> max_ooctx_meth_frac, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_bed_report(SEXP dfSEXP, SEXP bedSEXP, SEXP bed_typeSEXP, SEXP toleranceSEXP, SEXP min_overlapSEXP, SEXP match_allSEXP, SEXP thresholdSEXP, SEXP ctx_methSEXP, SEXP ctx_unmethSEXP, SEXP ooctx_methSEXP, SEXP ooctx_unmethSEXP, SEXP min_n_ctxSEXP, SEXP min_ctx_meth_fracSEXP, SEXP max_ooctx_meth_fracSEXP, SEXP nthreadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type bed(bedSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type bed_type(bed_typeSEXP);
+    Rcpp::traits::input_parameter< const int >::type tolerance(toleranceSEXP);
+    Rcpp::traits::input_parameter< const signed int >::type min_overlap(min_overlapSEXP);
+    Rcpp::traits::input_parameter< const bool >::type match_all(match_allSEXP);
+    Rcpp::traits::input_parameter< const bool >::type threshold(thresholdSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ctx_meth(ctx_methSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ctx_unmeth(ctx_unmethSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ooctx_meth(ooctx_methSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ooctx_unmeth(ooctx_unmethSEXP);
+    Rcpp::traits::input_parameter< const std::vector<unsigned int> >::type min_n_ctx(min_n_ctxSEXP);
+    Rcpp::traits::input_parameter< const std::vector<double> >::type min_ctx_meth_frac(min_ctx_meth_fracSEXP);
+    Rcpp::traits::input_parameter< const std::vector<double> >::type max_ooctx_meth_frac(max_ooctx_meth_fracSEXP);
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_bed_report(df, bed, bed_type, tolerance, min_overlap, match_all, threshold, ctx_meth, ctx_unmeth, ooctx_meth, ooctx_unmeth, min_n_ctx, min_ctx_meth_frac, max_ooctx_meth_frac, nthreads));
     return rcpp_result_gen;
 END_RCPP
 }
 // rcpp_mhl_report
-Rcpp::DataFrame rcpp_mhl_report(Rcpp::DataFrame& df, const std::string ctx, int hmax, const int hmin, const double max_ooctx_meth_frac);
-RcppExport SEXP _epialleleR_rcpp_mhl_report(SEXP dfSEXP, SEXP ctxSEXP, SEXP hmaxSEXP, SEXP hminSEXP, SEXP max_ooctx_meth_fracSEXP) {
+Rcpp::DataFrame rcpp_mhl_report(Rcpp::DataFrame& df, const std::string ctx, const int hmax, const int hmin, const double max_ooctx_meth_frac, const bool merge_strands, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_mhl_report(SEXP dfSEXP, SEXP ctxSEXP, SEXP hmaxSEXP, SEXP hminSEXP, SEXP max_ooctx_meth_fracSEXP, SEXP merge_strandsSEXP, SEXP nthreadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ctx(ctxSEXP);
+    Rcpp::traits::input_parameter< const int >::type hmax(hmaxSEXP);
+    Rcpp::traits::input_parameter< const int >::type hmin(hminSEXP);
+    Rcpp::traits::input_parameter< const double >::type max_ooctx_meth_frac(max_ooctx_meth_fracSEXP);
+    Rcpp::traits::input_parameter< const bool >::type merge_strands(merge_strandsSEXP);
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_mhl_report(df, ctx, hmax, hmin, max_ooctx_meth_frac, merge_strands, nthreads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_mhl_bed_report
+Rcpp::DataFrame rcpp_mhl_bed_report(Rcpp::DataFrame& df, Rcpp::DataFrame& bed, const std::string ctx, const int hmax, const int hmin, const double max_ooctx_meth_frac, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_mhl_bed_report(SEXP dfSEXP, SEXP bedSEXP, SEXP ctxSEXP, SEXP hmaxSEXP, SEXP hminSEXP, SEXP max_ooctx_meth_fracSEXP, SEXP nthreadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
     Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type bed(bedSEXP);
     Rcpp::traits::input_parameter< const std::string >::type ctx(ctxSEXP);
-    Rcpp::traits::input_parameter< int >::type hmax(hmaxSEXP);
+    Rcpp::traits::input_parameter< const int >::type hmax(hmaxSEXP);
     Rcpp::traits::input_parameter< const int >::type hmin(hminSEXP);
     Rcpp::traits::input_parameter< const double >::type max_ooctx_meth_frac(max_ooctx_meth_fracSEXP);
-    rcpp_result_gen = Rcpp::wrap(rcpp_mhl_report(df, ctx, hmax, hmin, max_ooctx_meth_frac));
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_mhl_bed_report(df, bed, ctx, hmax, hmin, max_ooctx_meth_frac, nthreads));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -213,6 +533,21 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// rcpp_read_vcf
+Rcpp::List rcpp_read_vcf(std::string fn, std::vector<std::string> rnames, std::vector<std::string> regions, bool use_regions, int nthreads);
+RcppExport SEXP _epialleleR_rcpp_read_vcf(SEXP fnSEXP, SEXP rnamesSEXP, SEXP regionsSEXP, SEXP use_regionsSEXP, SEXP nthreadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< std::string >::type fn(fnSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type rnames(rnamesSEXP);
+    Rcpp::traits::input_parameter< std::vector<std::string> >::type regions(regionsSEXP);
+    Rcpp::traits::input_parameter< bool >::type use_regions(use_regionsSEXP);
+    Rcpp::traits::input_parameter< int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_read_vcf(fn, rnames, regions, use_regions, nthreads));
+    return rcpp_result_gen;
+END_RCPP
+}
 // rcpp_simulate_bam
 int rcpp_simulate_bam(std::vector<std::string> header, Rcpp::DataFrame& fields, Rcpp::DataFrame& i_tags, Rcpp::DataFrame& f_tags, Rcpp::DataFrame& s_tags, Rcpp::DataFrame& a_tags, std::vector<std::string> a_types, std::string out_fn);
 RcppExport SEXP _epialleleR_rcpp_simulate_bam(SEXP headerSEXP, SEXP fieldsSEXP, SEXP i_tagsSEXP, SEXP f_tagsSEXP, SEXP s_tagsSEXP, SEXP a_tagsSEXP, SEXP a_typesSEXP, SEXP out_fnSEXP) {
@@ -232,8 +567,8 @@ BEGIN_RCPP
 END_RCPP
 }
 // rcpp_threshold_reads
-std::vector<bool> rcpp_threshold_reads(Rcpp::DataFrame& df, const std::string ctx_meth, const std::string ctx_unmeth, const std::string ooctx_meth, const std::string ooctx_unmeth, const unsigned int min_n_ctx, const double min_ctx_meth_frac, const double max_ooctx_meth_frac);
-RcppExport SEXP _epialleleR_rcpp_threshold_reads(SEXP dfSEXP, SEXP ctx_methSEXP, SEXP ctx_unmethSEXP, SEXP ooctx_methSEXP, SEXP ooctx_unmethSEXP, SEXP min_n_ctxSEXP, SEXP min_ctx_meth_fracSEXP, SEXP max_ooctx_meth_fracSEXP) {
+Rcpp::LogicalVector rcpp_threshold_reads(Rcpp::DataFrame& df, const std::string ctx_meth, const std::string ctx_unmeth, const std::string ooctx_meth, const std::string ooctx_unmeth, const unsigned int min_n_ctx, const double min_ctx_meth_frac, const double max_ooctx_meth_frac, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_threshold_reads(SEXP dfSEXP, SEXP ctx_methSEXP, SEXP ctx_unmethSEXP, SEXP ooctx_methSEXP, SEXP ooctx_unmethSEXP, SEXP min_n_ctxSEXP, SEXP min_ctx_meth_fracSEXP, SEXP max_ooctx_meth_fracSEXP, SEXP nthreadsSEXP) {
 BEGIN_RCPP
     Rcpp::RObject rcpp_result_gen;
     Rcpp::RNGScope rcpp_rngScope_gen;
@@ -245,7 +580,27 @@ BEGIN_RCPP
     Rcpp::traits::input_parameter< const unsigned int >::type min_n_ctx(min_n_ctxSEXP);
     Rcpp::traits::input_parameter< const double >::type min_ctx_meth_frac(min_ctx_meth_fracSEXP);
     Rcpp::traits::input_parameter< const double >::type max_ooctx_meth_frac(max_ooctx_meth_fracSEXP);
-    rcpp_result_gen = Rcpp::wrap(rcpp_threshold_reads(df, ctx_meth, ctx_unmeth, ooctx_meth, ooctx_unmeth, min_n_ctx, min_ctx_meth_frac, max_ooctx_meth_frac));
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_threshold_reads(df, ctx_meth, ctx_unmeth, ooctx_meth, ooctx_unmeth, min_n_ctx, min_ctx_meth_frac, max_ooctx_meth_frac, nthreads));
+    return rcpp_result_gen;
+END_RCPP
+}
+// rcpp_threshold_reads_grid
+Rcpp::RawMatrix rcpp_threshold_reads_grid(Rcpp::DataFrame& df, const std::string ctx_meth, const std::string ctx_unmeth, const std::string ooctx_meth, const std::string ooctx_unmeth, const std::vector<unsigned int> min_n_ctx, const std::vector<double> min_ctx_meth_frac, const std::vector<double> max_ooctx_meth_frac, const int nthreads);
+RcppExport SEXP _epialleleR_rcpp_threshold_reads_grid(SEXP dfSEXP, SEXP ctx_methSEXP, SEXP ctx_unmethSEXP, SEXP ooctx_methSEXP, SEXP ooctx_unmethSEXP, SEXP min_n_ctxSEXP, SEXP min_ctx_meth_fracSEXP, SEXP max_ooctx_meth_fracSEXP, SEXP nthreadsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< Rcpp::DataFrame& >::type df(dfSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ctx_meth(ctx_methSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ctx_unmeth(ctx_unmethSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ooctx_meth(ooctx_methSEXP);
+    Rcpp::traits::input_parameter< const std::string >::type ooctx_unmeth(ooctx_unmethSEXP);
+    Rcpp::traits::input_parameter< const std::vector<unsigned int> >::type min_n_ctx(min_n_ctxSEXP);
+    Rcpp::traits::input_parameter< const std::vector<double> >::type min_ctx_meth_frac(min_ctx_meth_fracSEXP);
+    Rcpp::traits::input_parameter< const std::vector<double> >::type max_ooctx_meth_frac(max_ooctx_meth_fracSEXP);
+    Rcpp::traits::input_parameter< const int >::type nthreads(nthreadsSEXP);
+    rcpp_result_gen = Rcpp::wrap(rcpp_threshold_reads_grid(df, ctx_meth, ctx_unmeth, ooctx_meth, ooctx_unmeth, min_n_ctx, min_ctx_meth_frac, max_ooctx_meth_frac, nthreads));
     return rcpp_result_gen;
 END_RCPP
 }
@@ -253,20 +608,42 @@ END_RCPP
 static const R_CallMethodDef CallEntries[] = {
     {"_epialleleR_rcpp_call_methylation_genome", (DL_FUNC) &_epialleleR_rcpp_call_methylation_genome, 5},
     {"_epialleleR_rcpp_check_bam", (DL_FUNC) &_epialleleR_rcpp_check_bam, 1},
-    {"_epialleleR_rcpp_cx_report", (DL_FUNC) &_epialleleR_rcpp_cx_report, 3},
-    {"_epialleleR_rcpp_extract_patterns", (DL_FUNC) &_epialleleR_rcpp_extract_patterns, 10},
-    {"_epialleleR_rcpp_fep", (DL_FUNC) &_epialleleR_rcpp_fep, 2},
-    {"_epialleleR_rcpp_get_base_freqs", (DL_FUNC) &_epialleleR_rcpp_get_base_freqs, 3},
-    {"_epialleleR_rcpp_get_xm_beta", (DL_FUNC) &_epialleleR_rcpp_get_xm_beta, 3},
-    {"_epialleleR_rcpp_match_amplicon", (DL_FUNC) &_epialleleR_rcpp_match_amplicon, 3},
-    {"_epialleleR_rcpp_match_capture", (DL_FUNC) &_epialleleR_rcpp_match_capture, 3},
-    {"_epialleleR_rcpp_mhl_report", (DL_FUNC) &_epialleleR_rcpp_mhl_report, 5},
+    {"_epialleleR_rcpp_cluster_patterns", (DL_FUNC) &_epialleleR_rcpp_cluster_patterns, 8},
+    {"_epialleleR_rcpp_cx_acc_create", (DL_FUNC) &_epialleleR_rcpp_cx_acc_create, 0},
+    {"_epialleleR_rcpp_cx_acc_add", (DL_FUNC) &_epialleleR_rcpp_cx_acc_add, 3},
+    {"_epialleleR_rcpp_cx_acc_merge", (DL_FUNC) &_epialleleR_rcpp_cx_acc_merge, 1},
+    {"_epialleleR_rcpp_cx_acc_save", (DL_FUNC) &_epialleleR_rcpp_cx_acc_save, 2},
+    {"_epialleleR_rcpp_cx_acc_load", (DL_FUNC) &_epialleleR_rcpp_cx_acc_load, 1},
+    {"_epialleleR_rcpp_cx_acc_report", (DL_FUNC) &_epialleleR_rcpp_cx_acc_report, 3},
+    {"_epialleleR_rcpp_cx_matrix", (DL_FUNC) &_epialleleR_rcpp_cx_matrix, 5},
+    {"_epialleleR_rcpp_cx_mhl_report", (DL_FUNC) &_epialleleR_rcpp_cx_mhl_report, 8},
+    {"_epialleleR_rcpp_cx_report", (DL_FUNC) &_epialleleR_rcpp_cx_report, 4},
+    {"_epialleleR_rcpp_cx_track", (DL_FUNC) &_epialleleR_rcpp_cx_track, 8},
+    {"_epialleleR_rcpp_read_track", (DL_FUNC) &_epialleleR_rcpp_read_track, 4},
+    {"_epialleleR_rcpp_extract_patterns", (DL_FUNC) &_epialleleR_rcpp_extract_patterns, 13},
+    {"_epialleleR_rcpp_fep", (DL_FUNC) &_epialleleR_rcpp_fep, 3},
+    {"_epialleleR_rcpp_get_base_freqs", (DL_FUNC) &_epialleleR_rcpp_get_base_freqs, 4},
+    {"_epialleleR_rcpp_get_allele_freqs", (DL_FUNC) &_epialleleR_rcpp_get_allele_freqs, 6},
+    {"_epialleleR_rcpp_get_xm_beta", (DL_FUNC) &_epialleleR_rcpp_get_xm_beta, 4},
+    {"_epialleleR_rcpp_get_bed_ecdf", (DL_FUNC) &_epialleleR_rcpp_get_bed_ecdf, 9},
+    {"_epialleleR_rcpp_heterogeneity_report", (DL_FUNC) &_epialleleR_rcpp_heterogeneity_report, 5},
+    {"_epialleleR_rcpp_heterogeneity_bed_report", (DL_FUNC) &_epialleleR_rcpp_heterogeneity_bed_report, 6},
+    {"_epialleleR_rcpp_linkage", (DL_FUNC) &_epialleleR_rcpp_linkage, 10},
+    {"_epialleleR_rcpp_match_amplicon", (DL_FUNC) &_epialleleR_rcpp_match_amplicon, 4},
+    {"_epialleleR_rcpp_match_amplicon_all", (DL_FUNC) &_epialleleR_rcpp_match_amplicon_all, 4},
+    {"_epialleleR_rcpp_match_capture", (DL_FUNC) &_epialleleR_rcpp_match_capture, 4},
+    {"_epialleleR_rcpp_match_capture_all", (DL_FUNC) &_epialleleR_rcpp_match_capture_all, 4},
+    {"_epialleleR_rcpp_bed_report", (DL_FUNC) &_epialleleR_rcpp_bed_report, 15},
+    {"_epialleleR_rcpp_mhl_report", (DL_FUNC) &_epialleleR_rcpp_mhl_report, 7},
+    {"_epialleleR_rcpp_mhl_bed_report", (DL_FUNC) &_epialleleR_rcpp_mhl_bed_report, 7},
     {"_epialleleR_rcpp_read_bam_paired", (DL_FUNC) &_epialleleR_rcpp_read_bam_paired, 7},
     {"_epialleleR_rcpp_read_bam_single", (DL_FUNC) &_epialleleR_rcpp_read_bam_single, 7},
     {"_epialleleR_rcpp_read_bam_mm_single", (DL_FUNC) &_epialleleR_rcpp_read_bam_mm_single, 9},
     {"_epialleleR_rcpp_read_genome", (DL_FUNC) &_epialleleR_rcpp_read_genome, 2},
+    {"_epialleleR_rcpp_read_vcf", (DL_FUNC) &_epialleleR_rcpp_read_vcf, 5},
     {"_epialleleR_rcpp_simulate_bam", (DL_FUNC) &_epialleleR_rcpp_simulate_bam, 8},
-    {"_epialleleR_rcpp_threshold_reads", (DL_FUNC) &_epialleleR_rcpp_threshold_reads, 8},
+    {"_epialleleR_rcpp_threshold_reads", (DL_FUNC) &_epialleleR_rcpp_threshold_reads, 9},
+    {"_epialleleR_rcpp_threshold_reads_grid", (DL_FUNC) &_epialleleR_rcpp_threshold_reads_grid, 9},
     {NULL, NULL, 0}
 };
 
@@ -1,5 +1,14 @@
 // Global definitions
 
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <string>
+#include <vector>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 
 // FNV-1a hash
 // http://www.isthe.com/chongo/tech/comp/fnv/
@@ -12,6 +21,21 @@
   }                                                                            \
 }                                                                              
 
+// Word-at-a-time 64-bit hash (MurmurHash3 finalizer applied to every word).
+// Much faster than FNV-1a above, but used as in-memory key only: IDs reported
+// to the user are still FNV-1a hashes
+#define HASH64_SEED 0x9E3779B97F4A7C15u
+inline uint64_t hash64_mix(uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xFF51AFD7ED558CCDu;
+  x ^= x >> 33;
+  x *= 0xC4CEB9FE1A85EC53u;
+  x ^= x >> 33;
+  return x;
+}
+#define hash64_add(hash, word) { hash = hash64_mix((hash) ^ (uint64_t)(word)); }
+
 // Cytosine context to index (ctx_to_idx) conversion:
 // ctx  bin       +2        >>2&15  idx
 // +    00101011  00101101  1011    11
@@ -37,6 +61,405 @@
 // Macro to unpack XM context index from packed SEQXM
 #define unpack_ctx_idx(c) ((c) & 15)
 
+// Per-template histogram of XM context indices (see the table above), i.e.
+// number of bases for every context index within packed SEQXM string
+typedef std::array<uint32_t, 16> T_ctx_hist;
+inline T_ctx_hist get_ctx_hist(const std::string &seqxm)
+{
+  T_ctx_hist hist = {0};
+  const unsigned char* seqxm_x = (const unsigned char*) seqxm.c_str();
+  const size_t size_x = seqxm.size();
+  size_t i = 0;
+#if defined(__SSE2__)
+  // 16 bytes at once: every bin has its own vector of byte counters that is
+  // incremented by the result of comparison (0xFF == -1 for matching bytes).
+  // Counters are flushed before they can overflow, i.e., every 255 iterations
+  const __m128i lo_mask = _mm_set1_epi8(15);
+  const __m128i zero = _mm_setzero_si128();
+  const size_t size_v = size_x & ~(size_t)15;
+  while (i<size_v) {
+    __m128i acc[16];
+    for (unsigned int b=0; b<16; b++) acc[b] = zero;
+    const size_t block_end = std::min(size_v, i + 255*16);
+    for (; i<block_end; i+=16) {
+      const __m128i v = _mm_and_si128(_mm_loadu_si128((const __m128i*)(seqxm_x+i)), lo_mask);   // lower 4 bits (XM)
+      for (unsigned int b=0; b<16; b++)
+        acc[b] = _mm_sub_epi8(acc[b], _mm_cmpeq_epi8(v, _mm_set1_epi8(b)));
+    }
+    for (unsigned int b=0; b<16; b++) {
+      const __m128i sad = _mm_sad_epu8(acc[b], zero);                           // horizontal sum of byte counters as two 64-bit halves
+      hist[b] += _mm_cvtsi128_si32(sad) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sad, sad));
+    }
+  }
+#endif
+  for (; i<size_x; i++) {                                                       // char by char - it's faster this way than using std::string in the cycle
+    hist[unpack_ctx_idx(seqxm_x[i])]++;                                         // extract lower 4 bits (XM) and count them
+  }
+  return hist;
+}
+
+// Access to per-template context histograms of preprocessed BAM data.
+// Histograms are computed while reading BAM (attribute "ctxhist_xptr"), but
+// this attribute can be lost, e.g., when subsetting preprocessed data.
+// In such case (or if histograms don't match SEQXMs) they are recomputed here
+class ctx_hist_view {
+  std::vector<T_ctx_hist> own;                                                  // histograms computed on the fly
+  const std::vector<T_ctx_hist> *hist;                                          // histograms to use
+public:
+  ctx_hist_view(Rcpp::DataFrame &df, const std::vector<std::string> &seqxm,
+                const int nthreads=1) {
+    SEXP ctxhist_xptr = df.attr("ctxhist_xptr");
+    if (ctxhist_xptr!=R_NilValue) {
+      Rcpp::XPtr<std::vector<T_ctx_hist>> ctxhist(ctxhist_xptr);
+      if (ctxhist.get() && ctxhist->size()==seqxm.size()) {
+        hist = ctxhist.get();
+        return;
+      }
+    }
+    own.resize(seqxm.size());
+#pragma omp parallel for schedule(dynamic, 4096) num_threads(nthreads)
+    for (size_t i=0; i<seqxm.size(); i++) own[i] = get_ctx_hist(seqxm[i]);
+    hist = &own;
+  }
+  const T_ctx_hist& operator[](const size_t i) const { return (*hist)[i]; }     // histogram by template id
+};
+
+// Index of the first read with (rname, start) not less than (chr, pos)
+inline size_t first_read(const int *rname, const int *start, const size_t nreads,
+                         const int chr, const long long pos)
+{
+  size_t lo = 0, hi = nreads;
+  while (lo<hi) {
+    const size_t mid = lo + (hi-lo)/2;
+    if (rname[mid]<chr || (rname[mid]==chr && start[mid]<pos)) lo = mid+1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+// Partitions of sorted reads for parallel per-cytosine reports (lMHL,
+// heterogeneity): boundaries are at reference changes or at gaps wider than
+// max_gap, i.e., where the window map is flushed anyway, therefore results
+// don't depend on partitioning. Partitions are at least min_part_size reads
+// long, if possible. Returns the first read of every partition followed by the
+// number of reads. Checks for the interrupt: call outside of parallel regions
+inline std::vector<unsigned int> get_read_parts(const int *rname, const int *start,
+                                                const int *templid, const size_t nreads,
+                                                const std::vector<std::string> &seqxm,
+                                                const int max_gap,
+                                                const unsigned int min_part_size = 0x10000)
+{
+  std::vector<unsigned int> parts {0};                                          // first read of every partition
+  int part_max_pos = 0;
+  for (unsigned int x=0; x<nreads; x++) {
+    // checking for the interrupt
+    if ((x & 0xFFFFF) == 0) Rcpp::checkUserInterrupt();
+    
+    if (x && (rname[x]!=rname[x-1] ||
+              (start[x]>part_max_pos+max_gap && x-parts.back()>=min_part_size))) {
+      parts.push_back(x);
+      part_max_pos = 0;
+    }
+    part_max_pos = std::max(part_max_pos, start[x] + (int)seqxm[templid[x]].size() - 1);
+  }
+  parts.push_back(nreads);
+  return parts;
+}
+
+// Concatenates one field of per-partition results (partitions are ordered, so
+// are the results), releasing memory of the partitions early
+template <typename R, typename T>
+inline std::vector<T> concat_parts(std::vector<R> &part_res, std::vector<T> R::*field)
+{
+  size_t nitems = 0;
+  for (const R &res : part_res) nitems += (res.*field).size();
+  std::vector<T> out;
+  out.reserve(nitems);
+  for (R &res : part_res) {
+    out.insert(out.end(), (res.*field).begin(), (res.*field).end());
+    std::vector<T>().swap(res.*field);                                          // release memory early
+  }
+  return out;
+}
+
+// Bit-parallel per-read states of within-context bases.
+// Positions of all within-context bases observed in the data are indexed per
+// reference sequence (reverse strand positions are shifted by reverse_offset,
+// e.g., by 1 to merge both strands of CpGs), and every read is represented by
+// two bitsets over the ordinals of this index spanned by the read: covered
+// (within-context base present) and methylated (uppercase within-context
+// base). Within-context bases of a read in any range of positions are then
+// found by scanning the set bits of a range of words instead of decoding SEQXM
+// strings char by char (used to build haplotypes in rcpp_linkage).
+class T_ctx_bits {
+  std::vector<std::vector<int>> index;                                          // per-rname sorted positions of within-context bases
+  std::vector<int> read_rname;                                                  // rname of the read (0 if no within-context bases)
+  std::vector<unsigned int> first, nbits;                                       // first ordinal and number of ordinals spanned by the read
+  std::vector<size_t> offset;                                                   // offset of the read's bitsets in the pools, in words
+  std::vector<uint64_t> covered, meth;                                          // pools of bitsets
+
+public:
+  size_t max_size = 0;                                                          // max read length, to find reads overlapping a position
+  bool sorted = true;                                                           // are reads sorted by rname and start
+  
+  T_ctx_bits(const int *rname, const int *strand, const int *start,
+             const int *templid, const size_t nreads,
+             const std::vector<std::string> &seqxm, const unsigned int *ctx_map,
+             const unsigned int reverse_offset, const int nthreads=1) :
+    read_rname(nreads, 0), first(nreads, 0), nbits(nreads, 0), offset(nreads+1, 0) {
+    const int nchunks = std::max(1, nthreads);
+    int max_rname = 0;
+    for (size_t x=0; x<nreads; x++) {
+      if (x>0 && (rname[x]<rname[x-1] || (rname[x]==rname[x-1] && start[x]<start[x-1])))
+        sorted = false;
+      max_rname = std::max(max_rname, rname[x]);
+      max_size = std::max(max_size, seqxm[templid[x]].size());
+    }
+    index.resize(max_rname + 1);
+    
+    // calls f(i, pos) for every within-context base of the read x
+    auto for_each_base = [&] (const size_t x, auto f) {
+      const char* seqxm_x = seqxm[templid[x]].c_str();
+      const size_t size_x = seqxm[templid[x]].size();
+      const int start_x = start[x] - (strand[x]==2 ? reverse_offset : 0);       // offset coordinates of reverse strand for symmetric methylation
+      for (size_t i=0; i<size_x; i++)
+        if (ctx_map[unpack_ctx_idx(seqxm_x[i])]) f(i, start_x + (int)i);
+    };
+    
+    // 1) per-rname positions, collected and deduplicated in chunks and then
+    //    merged serially
+    std::vector<std::vector<std::pair<int,int>>> chunk_pos (nchunks);
+#pragma omp parallel for schedule(static) num_threads(nthreads)
+    for (int t=0; t<nchunks; t++) {
+      std::vector<std::pair<int,int>> &pos = chunk_pos[t];
+      for (size_t x=nreads*t/nchunks; x<nreads*(t+1)/nchunks; x++)
+        for_each_base(x, [&] (const size_t i, const int p) {
+          pos.emplace_back(rname[x], p);                                        // every position: overlapping reads can have different ones
+        });
+      std::sort(pos.begin(), pos.end());                                        // duplicates are removed within the chunk first
+      pos.erase(std::unique(pos.begin(), pos.end()), pos.end());
+    }
+    for (int t=0; t<nchunks; t++) {
+      for (const auto &p : chunk_pos[t]) index[p.first].push_back(p.second);
+      std::vector<std::pair<int,int>>().swap(chunk_pos[t]);
+    }
+    for (auto &idx : index) {
+      std::sort(idx.begin(), idx.end());
+      idx.erase(std::unique(idx.begin(), idx.end()), idx.end());
+    }
+    
+    // 2) ordinal span of every read
+#pragma omp parallel for schedule(dynamic, 4096) num_threads(nthreads)
+    for (size_t x=0; x<nreads; x++) {
+      int lo = INT_MAX, hi = INT_MIN;
+      for_each_base(x, [&] (const size_t i, const int p) {
+        lo = std::min(lo, p);
+        hi = std::max(hi, p);
+      });
+      if (lo>hi) continue;                                                      // no within-context bases
+      read_rname[x] = rname[x];
+      first[x] = ordinal(rname[x], lo);
+      nbits[x] = ordinal(rname[x], hi) - first[x] + 1;
+    }
+    for (size_t x=0; x<nreads; x++) offset[x+1] = offset[x] + ((nbits[x] + 63) >> 6);
+    covered.assign(offset[nreads], 0);
+    meth.assign(offset[nreads], 0);
+    
+    // 3) bitsets, positions within the read are increasing
+#pragma omp parallel for schedule(dynamic, 4096) num_threads(nthreads)
+    for (size_t x=0; x<nreads; x++) {
+      if (!nbits[x]) continue;
+      const std::vector<int> &idx = index[rname[x]];
+      const char* seqxm_x = seqxm[templid[x]].c_str();
+      uint64_t *cov_x = covered.data() + offset[x];
+      uint64_t *meth_x = meth.data() + offset[x];
+      size_t o = first[x];
+      for_each_base(x, [&] (const size_t i, const int p) {
+        while (idx[o]<p) o++;
+        const size_t b = o - first[x];
+        cov_x[b>>6] |= (uint64_t)1 << (b & 63);
+        meth_x[b>>6] |= (uint64_t)!(unpack_ctx_idx(seqxm_x[i]) & 8) << (b & 63); // methylated (0 for lowercase, 1 for uppercase)
+      });
+    }
+  }
+  
+  // ordinal of the first indexed position not less than pos
+  unsigned int ordinal(const int rname, const int pos) const {
+    if (rname<0 || (size_t)rname>=index.size()) return 0;
+    const std::vector<int> &idx = index[rname];
+    return std::lower_bound(idx.begin(), idx.end(), pos) - idx.begin();
+  }
+  
+  // calls f(pos, meth) for every within-context base of the read x at
+  // indexed positions [from, to] (offset coordinates), in order of position
+  template <typename F>
+  void for_each_covered(const size_t x, const int from, const int to, F f) const {
+    if (!nbits[x] || from>to) return;
+    const unsigned int lo = std::max(ordinal(read_rname[x], from), first[x]);   // ordinals of the range
+    const unsigned int hi = std::min(ordinal(read_rname[x], to+1), first[x] + nbits[x]);
+    if (lo>=hi) return;                                                         // no indexed positions of the read within the range
+    const int *idx = index[read_rname[x]].data() + first[x];
+    const uint64_t *cov_x = covered.data() + offset[x];
+    const uint64_t *meth_x = meth.data() + offset[x];
+    const size_t bf = lo - first[x], bt = hi - first[x] - 1;                    // first and last bits of the range
+    for (size_t w=bf>>6; w<=bt>>6; w++) {
+      uint64_t bits = cov_x[w];
+      if (w==bf>>6) bits &= ~(uint64_t)0 << (bf & 63);
+      if (w==bt>>6) bits &= ~(uint64_t)0 >> (63 - (bt & 63));
+      while (bits) {                                                            // set bits only
+        const size_t b = (w << 6) | __builtin_ctzll(bits);
+        f(idx[b], (bool)((meth_x[w] >> (b & 63)) & 1));
+        bits &= bits - 1;
+      }
+    }
+  }
+};
+
+// Read thresholding criteria for one or several combinations of thresholds
+// (min_n_ctx, min_ctx_meth_frac and max_ooctx_meth_frac must be of the same
+// length, one element per combination), applied to per-template context
+// histograms. Used by rcpp_threshold_reads, rcpp_threshold_reads_grid and
+// rcpp_bed_report
+class T_read_thresholds {
+  std::vector<unsigned int> ctx_meth_idx, ctx_unmeth_idx;                       // context indices
+  std::vector<unsigned int> ooctx_meth_idx, ooctx_unmeth_idx;                   // out-of-context indices
+  std::vector<unsigned int> min_n_ctx;                                          // minimum numbers of context bases
+  std::vector<double> min_ctx_meth_frac, max_ooctx_meth_frac;                   // minimum context and maximum out-of-context beta values
+  static std::vector<unsigned int> to_idx(const std::string &str) {
+    std::vector<unsigned int> idx;
+    for (const char &c : str) idx.push_back(ctx_to_idx(c));
+    return idx;
+  }
+public:
+  T_read_thresholds(const std::string &ctx_meth, const std::string &ctx_unmeth,
+                    const std::string &ooctx_meth, const std::string &ooctx_unmeth,
+                    const std::vector<unsigned int> &min_n_ctx,
+                    const std::vector<double> &min_ctx_meth_frac,
+                    const std::vector<double> &max_ooctx_meth_frac) :
+    ctx_meth_idx(to_idx(ctx_meth)), ctx_unmeth_idx(to_idx(ctx_unmeth)),
+    ooctx_meth_idx(to_idx(ooctx_meth)), ooctx_unmeth_idx(to_idx(ooctx_unmeth)),
+    min_n_ctx(min_n_ctx), min_ctx_meth_frac(min_ctx_meth_frac),
+    max_ooctx_meth_frac(max_ooctx_meth_frac) {
+    if (min_ctx_meth_frac.size()!=min_n_ctx.size() || max_ooctx_meth_frac.size()!=min_n_ctx.size())
+      Rcpp::stop("Threshold vectors must be of the same length");
+  }
+  size_t size() const { return min_n_ctx.size(); }                              // number of combinations
+  
+  // calls f(c) for every combination of thresholds c the read passes
+  template <typename F>
+  void for_each_pass(const T_ctx_hist &ctx_map, F f) const {
+    unsigned int n_ctx_meth = 0, n_ctx_unmeth = 0, n_ooctx_meth = 0, n_ooctx_unmeth = 0;
+    for (const unsigned int &i : ctx_meth_idx) n_ctx_meth += ctx_map[i];
+    if (n_ctx_meth==0) return;                                                  // no methylated context bases
+    for (const unsigned int &i : ctx_unmeth_idx) n_ctx_unmeth += ctx_map[i];
+    for (const unsigned int &i : ooctx_meth_idx) n_ooctx_meth += ctx_map[i];
+    for (const unsigned int &i : ooctx_unmeth_idx) n_ooctx_unmeth += ctx_map[i];
+    const unsigned int n_ctx_all = n_ctx_meth + n_ctx_unmeth;
+    const double ctx_meth_frac = (double)n_ctx_meth / n_ctx_all;
+    const double ooctx_meth_frac = n_ooctx_meth>0 ? (double)n_ooctx_meth / (n_ooctx_meth + n_ooctx_unmeth) : 0;
+    
+    for (size_t c=0; c<min_n_ctx.size(); c++) {
+      if (n_ctx_all<min_n_ctx[c]) continue;
+      if (ctx_meth_frac<min_ctx_meth_frac[c]) continue;
+      if (n_ooctx_meth>0 && ooctx_meth_frac>max_ooctx_meth_frac[c]) continue;
+      f(c);                                                                     // read has passed all thresholds of combination c
+    }
+  }
+};
+
+// Haplotype size (number of within-context bases) and out-of-context beta
+// value of a read, as used by lMHL reports to filter the reads. Takes
+// per-template context histogram and array of within-context indices
+inline void get_hap_stats(const T_ctx_hist &hist, const unsigned int *ctx_map,
+                          size_t &h_size, double &ooctx_meth_frac)
+{
+  size_t ooctx_meth = 0, ooctx_unmeth = 0;                                      // sums of o-o-ctx methylated and unmethylated
+  h_size = 0;
+  for (unsigned int idx : {2, 5, 6, 7}) {                                       // methylated
+    if (ctx_map[idx]) h_size += hist[idx];
+    else ooctx_meth += hist[idx];
+  }
+  for (unsigned int idx : {10, 13, 14, 15}) {                                   // unmethylated
+    if (ctx_map[idx]) h_size += hist[idx];
+    else ooctx_unmeth += hist[idx];
+  }
+  ooctx_meth_frac = (double)ooctx_meth / (ooctx_meth+ooctx_unmeth);             // fraction of o-o-ctx methylated
+}
+
+// Most frequent context at a position of CX/lMHL reports.
+// Takes an array of per-context counters (16 per strand, coverage at [9], see
+// rcpp_cx_report.cpp) and strand shift (0 for F and 16 for R). Returns context
+// index (2: H, 6: X, 7: Z) if this context is observed in more than 50% of the
+// reads, and 0 if position is not covered, most of the bases are '.' or none of
+// the contexts is observed in more than 50% of the reads
+template <typename T>
+inline unsigned int get_major_ctx_idx(const T &val, const unsigned int shft)
+{
+  const auto half_cov = val[9+shft] / 2;                                        // halve the coverage
+  if (val[9+shft]==0) return 0;                                                 // not covered
+  if (val[12+shft] > half_cov) return 0;                                        // most are .
+  if ((val[2+shft] + val[10+shft]) > half_cov) return 2;                        // H
+  if ((val[6+shft] + val[14+shft]) > half_cov) return 6;                        // X
+  if ((val[7+shft] + val[15+shft]) > half_cov) return 7;                        // Z
+  return 0;                                                                     // none is > 50%
+}
+
+// Offset of the reverse strand cytosine within symmetric contexts (by context
+// index): CG (Z) is paired with the next base, CHG (X) - with the one after it
+const unsigned int sym_ctx_offset[16] = {0, 0, 0, 0, 0, 0, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0};
+
+// Merging strands of symmetric contexts in CX/lMHL reports, shared by all
+// spit_results macros. Takes a map of per-position counters, iterator to the
+// current position, its major context index, strand (0 for F, 1 for R) and
+// shift of reverse strand counters within the map value. Forward strand
+// cytosine looks for the reverse strand mate of the same context, calls
+// fold(mate counters) to add them to its own, and marks the mate as merged
+// (zero coverage, skipped later). Reverse strand cytosine without a mate is
+// reported at the position of forward strand cytosine (out_pos is updated).
+// Returns true if context is symmetric, i.e., strand is to be reported as '*'
+template <typename M, typename F>
+inline bool merge_sym_strands(M &map, const typename M::iterator &it,
+                              const unsigned int idx, const int s,
+                              const unsigned int rev_shft, int &out_pos, F fold)
+{
+  if (!sym_ctx_offset[idx]) return false;                                       // not symmetric
+  if (s==0) {                                                                   // F: look for the R strand mate
+    typename M::iterator mate = map.find(it->first + sym_ctx_offset[idx]);
+    if (mate!=map.end() && get_major_ctx_idx(mate->second, rev_shft)==idx) {   // if mate is the same
+      fold(mate->second);                                                       // merge counters
+      mate->second[9+rev_shft] = 0;                                             // mate is merged, skip later
+    }
+  } else out_pos -= sym_ctx_offset[idx];                                        // R without mate: F position
+  return true;
+}
+
+// lMHL numerator or denominator for n successive bases: sum of all possible
+// lMHL combinations of length i from 1 to n, times i (see rcpp_mhl_report.cpp)
+inline uint64_t nrS(uint64_t n)
+{
+  if (n<2) return n;
+  return (n*(n+1)*(n+2))/6;
+}
+
+// lMHL lookup table of nrS(n) values for n in [0; MHL_LOOKUP_LEN), values for
+// n>hmax are capped at nrS(hmax). The table is built lazily and rebuilt only
+// when hmax changes between calls, therefore it must not be requested from
+// within parallel regions
+#define MHL_LOOKUP_LEN ((size_t)65536)
+inline const uint64_t* get_mhl_lookup(const int hmax)
+{
+  static std::vector<uint64_t> mhl_lookup;
+  static size_t lookup_hmax = 0;
+  const size_t h = (hmax>0) ? std::min((size_t)hmax, MHL_LOOKUP_LEN) : MHL_LOOKUP_LEN;  // number of context bases is always in range [1; MHL_LOOKUP_LEN]
+  if (mhl_lookup.empty() || lookup_hmax!=h) {
+    mhl_lookup.resize(MHL_LOOKUP_LEN);
+    for (size_t n=0; n<h; n++) mhl_lookup[n] = nrS(n);                          // filling the lMHL values for faster computations
+    std::fill(mhl_lookup.begin()+h, mhl_lookup.end(), nrS(h));                  // if hmax < MHL_LOOKUP_LEN - fill the rest of the lookup table with it
+    lookup_hmax = h;
+  }
+  return mhl_lookup.data();
+}
+
 // Genomic sequence-to-cytosine-context lookup tables
 // these 9-bit tables are built for the sequence containing ACGNT only,
 // will might at some point make 16-bit tables to allow any IUPAC nucleotide
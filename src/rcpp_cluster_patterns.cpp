@@ -0,0 +1,223 @@
+#include <Rcpp.h>
+#include <climits>
+#include <random>
+#include "epialleleR.h"
+// using namespace Rcpp;
+
+// Clusters methylation patterns (bit-packed output of rcpp_extract_patterns)
+// into epiallele groups using k-modes with Hamming distance.
+//
+// Every pattern is converted to two bitsets over positions: "present" and
+// "methylated". Distance between two patterns is the number of positions
+// present in both and having different methylation status, i.e.,
+// popcount((meth_a ^ meth_b) & present_a & present_b), therefore missing
+// positions never count as mismatches. Modes (consensus patterns) are of the
+// same structure: position is present if observed in any pattern of the
+// cluster, and methylated if methylated in the majority of them.
+//
+// Initial modes are chosen k-means++-style (probability proportional to
+// weighted distance to the closest mode already chosen) using Mersenne Twister
+// with given seed, serially, therefore results do not depend on the number of
+// threads. Patterns are then assigned to the closest mode (the first one in
+// case of ties) in parallel, modes are recomputed from per-chunk counts, and
+// it's repeated until assignments are stable or max_iter is reached.
+
+
+// [[Rcpp::plugins(cpp17)]]
+
+// Patterns as bitsets: for every pattern, nwords of present bits followed by
+// nwords of methylated bits
+class T_bit_patterns {
+public:
+  size_t npat, npos, nwords;
+  std::vector<uint64_t> bits;
+  
+  T_bit_patterns(const Rcpp::RawVector &packed, const size_t n_pat, const size_t n_pos) :
+    npat(n_pat), npos(n_pos), nwords((n_pos + 63) / 64), bits(n_pat * 2 * nwords, 0) {
+    const size_t stride = (npat + 3) / 4;                                       // bytes per position in packed matrix
+    if ((size_t)packed.size() != stride * npos)
+      Rcpp::stop("Size of packed matrix doesn't match the number of patterns and positions");
+    const uint8_t *packed_x = packed.begin();
+    for (size_t c=0; c<npos; c++) {
+      const uint64_t bit = (uint64_t)1 << (c & 63);
+      const size_t word = c >> 6;
+      for (size_t p=0; p<npat; p++) {
+        const unsigned int code = (packed_x[c*stride + p/4] >> ((p & 3) << 1)) & 3; // 0: absent, 1: unmethylated, 2: methylated
+        if (code==0) continue;
+        bits[p*2*nwords + word] |= bit;                                         // present
+        if (code==2) bits[p*2*nwords + nwords + word] |= bit;                   // methylated
+      }
+    }
+  }
+  
+  const uint64_t* get(const size_t p) const { return bits.data() + p*2*nwords; }
+};
+
+// Hamming distance over positions present in both patterns
+inline unsigned int hamming(const uint64_t *a, const uint64_t *b, const size_t nwords)
+{
+  unsigned int d = 0;
+  for (size_t w=0; w<nwords; w++)
+    d += __builtin_popcountll((a[nwords+w] ^ b[nwords+w]) & a[w] & b[w]);
+  return d;
+}
+
+// closest mode (the first one in case of ties) and the distance to it
+inline unsigned int closest(const uint64_t *pattern, const std::vector<uint64_t> &modes,
+                            const size_t nmodes, const size_t nwords, unsigned int &dist)
+{
+  unsigned int best = 0;
+  dist = UINT_MAX;
+  for (size_t m=0; m<nmodes && dist>0; m++) {
+    const unsigned int d = hamming(pattern, modes.data() + m*2*nwords, nwords);
+    if (d<dist) {
+      dist = d;
+      best = m;
+    }
+  }
+  return best;
+}
+
+
+// [[Rcpp::export]]
+Rcpp::List rcpp_cluster_patterns(Rcpp::RawVector &packed,                       // packed matrix of within-context bases
+                                 const int npat,                                // number of patterns
+                                 const int npos,                                // number of positions
+                                 std::vector<double> weight,                    // pattern weights (counts of unique patterns)
+                                 const int k,                                   // number of clusters
+                                 const int max_iter,                            // max number of iterations
+                                 const int seed,                                // seed for initial modes
+                                 const int nthreads)                            // number of threads
+{
+  if (k<1) Rcpp::stop("Number of clusters must be positive");
+  if (max_iter<1) Rcpp::stop("Number of iterations must be positive");
+  if (weight.size() != (size_t)npat) Rcpp::stop("Number of weights must match the number of patterns");
+  const T_bit_patterns patterns (packed, npat, npos);
+  const size_t nwords = patterns.nwords;
+  const size_t nmodes = std::min(k, std::max(npat, 1));                         // no more modes than patterns
+  
+  // k-means++-style initial modes, serially
+  std::vector<uint64_t> modes (nmodes * 2 * nwords, 0);
+  std::mt19937_64 rng (seed);
+  auto runif = [&rng] () { return (rng() >> 11) * 0x1.0p-53; };                 // [0;1), the same on every platform
+  std::vector<double> min_dist (npat, 0);
+  for (size_t m=0; m<nmodes && npat>0; m++) {
+    double total = 0;
+    for (int p=0; p<npat; p++) total += min_dist[p] * weight[p];
+    int chosen = 0;
+    if (m==0 || total==0) {                                                     // the first mode, or all patterns are the same as modes
+      chosen = std::min((int)(runif() * npat), npat-1);
+    } else {
+      double target = runif() * total;
+      for (chosen=0; chosen<npat-1; chosen++) {
+        target -= min_dist[chosen] * weight[chosen];
+        if (target<0) break;
+      }
+    }
+    std::copy(patterns.get(chosen), patterns.get(chosen) + 2*nwords, modes.begin() + m*2*nwords);
+    for (int p=0; p<npat; p++) {
+      const double d = hamming(patterns.get(p), modes.data() + m*2*nwords, nwords);
+      min_dist[p] = m==0 ? d : std::min(min_dist[p], d);
+    }
+  }
+  
+  // k-modes
+  std::vector<int> cluster (npat, -1);
+  std::vector<unsigned int> dist (npat, 0);
+  const int nchunks = std::max(1, nthreads);
+  std::vector<std::vector<double>> chunk_counts (nchunks);                      // per cluster and position: weighted unmethylated and methylated counts
+  int niter = 0;
+  bool changed = true;
+  while (changed && niter<max_iter) {
+    niter++;
+    changed = false;
+#pragma omp parallel for schedule(static) num_threads(nthreads)
+    for (int t=0; t<nchunks; t++) {
+      const int from = (long long)npat * t / nchunks;
+      const int to = (long long)npat * (t+1) / nchunks;
+      std::vector<double> &counts = chunk_counts[t];
+      counts.assign(nmodes * npos * 2, 0);
+      bool chunk_changed = false;
+      for (int p=from; p<to; p++) {
+        const uint64_t *pattern = patterns.get(p);
+        const int c = closest(pattern, modes, nmodes, nwords, dist[p]);
+        if (c!=cluster[p]) {
+          cluster[p] = c;
+          chunk_changed = true;
+        }
+        for (size_t w=0; w<nwords; w++) {                                       // count present bases
+          uint64_t present = pattern[w];
+          while (present) {
+            const unsigned int b = __builtin_ctzll(present);
+            const bool meth = (pattern[nwords+w] >> b) & 1;
+            counts[(c*npos + w*64 + b)*2 + meth] += weight[p];
+            present &= present - 1;
+          }
+        }
+      }
+#pragma omp critical
+      changed = changed || chunk_changed;
+    }
+    
+    // new modes: majority methylation status of present positions
+    std::vector<double> counts (nmodes * npos * 2, 0);
+    for (int t=0; t<nchunks; t++)
+      for (size_t i=0; i<counts.size(); i++) counts[i] += chunk_counts[t][i];
+    for (size_t m=0; m<nmodes; m++) {
+      uint64_t *mode = modes.data() + m*2*nwords;
+      const double *mode_counts = counts.data() + m*npos*2;
+      bool empty = true;
+      for (int c=0; c<npos && empty; c++) empty = mode_counts[c*2] + mode_counts[c*2+1] == 0;
+      if (empty) continue;                                                      // empty cluster keeps its mode
+      std::fill(mode, mode + 2*nwords, 0);
+      for (int c=0; c<npos; c++) {
+        if (mode_counts[c*2] + mode_counts[c*2+1] == 0) continue;
+        mode[c>>6] |= (uint64_t)1 << (c & 63);
+        if (mode_counts[c*2+1] > mode_counts[c*2]) mode[nwords + (c>>6)] |= (uint64_t)1 << (c & 63);
+      }
+    }
+  }
+  
+  // results
+  Rcpp::IntegerVector res_cluster (npat);
+  Rcpp::NumericVector res_size (nmodes, 0.0);
+  double cost = 0;
+  for (int p=0; p<npat; p++) {
+    res_cluster[p] = cluster[p] + 1;
+    res_size[cluster[p]] += weight[p];
+    cost += dist[p] * weight[p];
+  }
+  Rcpp::IntegerMatrix res_consensus (nmodes, npos);                             // 1: methylated, 0: unmethylated, NA: absent
+  for (size_t m=0; m<nmodes; m++) {
+    const uint64_t *mode = modes.data() + m*2*nwords;
+    for (int c=0; c<npos; c++) {
+      const bool present = (mode[c>>6] >> (c & 63)) & 1;
+      const bool meth = (mode[nwords + (c>>6)] >> (c & 63)) & 1;
+      res_consensus(m, c) = present ? meth : NA_INTEGER;
+    }
+  }
+  
+  return Rcpp::List::create(
+    Rcpp::Named("cluster") = res_cluster,
+    Rcpp::Named("consensus") = res_consensus,
+    Rcpp::Named("size") = res_size,
+    Rcpp::Named("cost") = cost,
+    Rcpp::Named("niter") = niter
+  );
+}
+
+
+// test code in R
+//
+
+/*** R
+bam <- preprocessBam(system.file("extdata", "amplicon010meth.bam", package="epialleleR"))
+packed <- extractPatterns(bam, system.file("extdata", "amplicon.bed", package="epialleleR"), bed.row=2, pack.patterns=TRUE)
+cl <- rcpp_cluster_patterns(packed$packed, nrow(packed$patterns), length(packed$positions), rep(1, nrow(packed$patterns)), 2, 100, 1, 1)
+table(cl$cluster)
+*/
+
+// Sourcing:
+// Rcpp::sourceCpp("rcpp_cluster_patterns.cpp")
+
+// #############################################################################
@@ -0,0 +1,422 @@
+#include <Rcpp.h>
+#include <array>
+#include <algorithm>
+#include <boost/container/flat_map.hpp>
+#include <htslib/bgzf.h>
+#include "epialleleR.h"
+
+// [[Rcpp::plugins(cpp17)]]
+// [[Rcpp::depends(BH)]]
+// [[Rcpp::depends(Rhtslib)]]
+
+
+// Persistent CX accumulator.
+// Holds cytosine counts for the reads of one or several BAM files, can absorb
+// reads of another BAM file (sequencing lane, top-up), be merged with other
+// accumulators, saved to and loaded from a compact binary file, and produce
+// the same CX report as rcpp_cx_report for all the reads it has ever seen.
+//
+// Accumulator is returned to R as a list with:
+// 1) field "rname"        - names of reference sequences
+// 2) field "npos"         - number of genomic positions with counts
+// 3) attribute "acc_xptr" - XPtr to cx_accumulator
+//
+// Counts are stored per genomic position as uint32[16] - 8 counters per strand
+// (only those that are needed to determine the context and to report it):
+// {0: 'H', 1: 'h', 2: 'X', 3: 'x', 4: 'Z', 5: 'z', 6: '.', 7: coverage}  # + strand
+// {8: 'H', 9: 'h', 10: 'X', 11: 'x', 12: 'Z', 13: 'z', 14: '.', 15: coverage}  # - strand
+// Positions are kept in a vector sorted by {32bit:rname, 32bit:pos}, new reads
+// are counted in a window map (as in CX report) and merged linearly.
+//
+// File format (BGZF-compressed):
+// "EPIACC" magic, uint16 version, uint32 number of reference names, names as
+// uint32 length + chars, uint64 number of positions, then for every position:
+// varint key delta, uint16 bitmask of non-zero counters, varint counters.
+
+// accumulator
+struct cx_accumulator {
+  typedef uint64_t T_key;                                                       // {32bit:rname, 32bit:pos}
+  typedef std::array<uint32_t,16> T_val;                                        // 8 counters per strand
+  typedef std::vector<std::pair<T_key,T_val>> T_entries;
+  std::vector<std::string> rname;                                               // reference names
+  T_entries entries;                                                            // sorted counts
+};
+
+// XM context index to accumulator counter (-1 for the ones counted as coverage only)
+const int acc_counter[16] = {-1, -1, 0, -1, -1, -1, 2, 4, -1, -1, 1, -1, 6, -1, 3, 5};
+
+// context index of accumulator counters
+const unsigned int acc_ctx_idx[8] = {2, 10, 6, 14, 7, 15, 12, 9};
+
+// merge two sorted entry vectors, summing counts for the same positions
+cx_accumulator::T_entries merge_entries (const cx_accumulator::T_entries &a,
+                                         const cx_accumulator::T_entries &b)
+{
+  cx_accumulator::T_entries res;
+  res.reserve(a.size() + b.size());
+  auto ia = a.begin(), ib = b.begin();
+  while (ia!=a.end() && ib!=b.end()) {
+    if (ia->first < ib->first) {
+      res.push_back(*ia++);
+    } else if (ib->first < ia->first) {
+      res.push_back(*ib++);
+    } else {
+      res.push_back(*ia++);
+      for (int k=0; k<16; k++) res.back().second[k] += ib->second[k];
+      ib++;
+    }
+  }
+  res.insert(res.end(), ia, a.end());
+  res.insert(res.end(), ib, b.end());
+  return res;
+}
+
+// remap rname ids of entries to the rnames of accumulator, adding new ones
+void remap_entries (cx_accumulator &acc,
+                    cx_accumulator::T_entries &entries,
+                    const std::vector<std::string> &rname)
+{
+  std::vector<uint64_t> rname_map(rname.size());
+  for (size_t r=0; r<rname.size(); r++) {
+    auto found = std::find(acc.rname.begin(), acc.rname.end(), rname[r]);
+    rname_map[r] = found - acc.rname.begin();
+    if (found==acc.rname.end()) acc.rname.push_back(rname[r]);
+  }
+  for (auto &e : entries)
+    e.first = (rname_map[e.first >> 32] << 32) | (e.first & 0xFFFFFFFF);
+  if (!std::is_sorted(entries.begin(), entries.end(),
+                      [] (const auto &x, const auto &y) {return x.first < y.first;}))
+    std::sort(entries.begin(), entries.end(),
+              [] (const auto &x, const auto &y) {return x.first < y.first;});
+}
+
+// wrap accumulator for R
+Rcpp::List wrap_accumulator (Rcpp::XPtr<cx_accumulator> &acc_xptr)
+{
+  Rcpp::List res = Rcpp::List::create(
+    Rcpp::Named("rname") = acc_xptr->rname,                                     // reference names
+    Rcpp::Named("npos") = (double)acc_xptr->entries.size()                      // number of positions
+  );
+  res.attr("acc_xptr") = acc_xptr;                                              // external pointer to accumulator
+  return res;
+}
+
+// unsigned LEB128 varint
+#define put_varint(buf, value) {                                                               \
+  uint64_t v = value;                                                                          \
+  while (v>=0x80) { buf.push_back((char)(v | 0x80)); v >>= 7; }                                \
+  buf.push_back((char)v);                                                                      \
+}
+uint64_t get_varint (BGZF *fp)                                                  // NB: closes file on error
+{
+  uint64_t v = 0;
+  for (int shift=0; shift<64; shift+=7) {
+    const int c = bgzf_getc(fp);
+    if (c<0) {
+      bgzf_close(fp);
+      Rcpp::stop("Unexpected end of accumulator file");
+    }
+    v |= (uint64_t)(c & 0x7F) << shift;
+    if (!(c & 0x80)) return v;
+  }
+  bgzf_close(fp);
+  Rcpp::stop("Malformed accumulator file");
+}
+
+
+// [[Rcpp::export("rcpp_cx_acc_create")]]
+Rcpp::List rcpp_cx_acc_create()
+{
+  Rcpp::XPtr<cx_accumulator> acc_xptr(new cx_accumulator, true);
+  return wrap_accumulator(acc_xptr);
+}
+
+
+// Absorbs reads of preprocessed BAM, accumulator is modified in place.
+// PRE-SORTED DATASET IS A REQUIREMENT.
+// [[Rcpp::export("rcpp_cx_acc_add")]]
+Rcpp::List rcpp_cx_acc_add(Rcpp::List &acc,                                     // accumulator
+                           Rcpp::DataFrame &df,                                 // data frame with BAM data
+                           Rcpp::LogicalVector &pass)                           // does it pass the threshold
+{
+  Rcpp::XPtr<cx_accumulator> acc_xptr((SEXP)acc.attr("acc_xptr"));
+  
+  Rcpp::IntegerVector rname   = df["rname"];                                    // template rname
+  Rcpp::IntegerVector strand  = df["strand"];                                   // template strand
+  Rcpp::IntegerVector start   = df["start"];                                    // template start
+  Rcpp::IntegerVector templid = df["templid"];                                  // template id, effectively holds indexes of corresponding std::string in std::vector
+  
+  Rcpp::XPtr<std::vector<std::string>> seqxm((SEXP)df.attr("seqxm_xptr"));      // merged refspaced packed template SEQXMs, as a pointer to std::vector<std::string>
+  
+  typedef boost::container::flat_map<uint32_t, cx_accumulator::T_val> T_acc_fmap;
+
+// macros
+#define spit_results {                                                          /* move window counts */ \
+  for (T_acc_fmap::iterator it=acc_map.begin(); it!=acc_map.end(); it++)                                 \
+    added.emplace_back(((uint64_t)(cur_rname-1) << 32) | it->first, it->second);                        \
+  max_pos=0;                                                                                             \
+  acc_map.clear();                                                                                       \
+  hint = acc_map.end();                                                                                  \
+};
+
+  // counting reads within windows, saving the results when necessary
+  cx_accumulator::T_entries added;
+  T_acc_fmap acc_map;
+  T_acc_fmap::iterator hint;
+  const cx_accumulator::T_val map_val = {0};
+  int max_pos = 0, cur_rname = 0, last_pos = 0;
+  
+  acc_map.reserve(100000);
+  for (unsigned int x=0; x<rname.size(); x++) {
+    // checking for the interrupt
+    if ((x & 0xFFFF) == 0) Rcpp::checkUserInterrupt();                          // every ~65k reads
+    
+    const int start_x = start[x];                                               // start of the current read
+    if ((start_x>max_pos) || (rname[x]!=cur_rname)) {                           // if current position is further downstream or another reference
+      spit_results;
+      cur_rname = rname[x];
+    }
+    const unsigned int str_shft = (strand[x]-1)<<3;                             // strand shift: 0 for F and 8 for R
+    const unsigned int pass_x = (!pass[x])<<3;                                  // should we lowercase this XM (TRUE==0, FALSE==8)
+    const char* seqxm_x = seqxm->at(templid[x]).c_str();                        // seqxm->at(templid[x]) is a reference to a corresponding SEQXM string
+    const unsigned int size_x = seqxm->at(templid[x]).size();                   // length of the current read
+    for (unsigned int i=0; i<size_x; i++) {                                     // char by char
+      const unsigned int ctx_idx = unpack_ctx_idx(seqxm_x[i]) | pass_x;         // extract lower 4 bits (XM); if not pass -> lowercase
+      if (ctx_idx==11) continue;                                                // skip +-
+      last_pos = start_x+i;
+      hint = acc_map.try_emplace(hint, last_pos, map_val);
+      if (acc_counter[ctx_idx]>=0) hint->second[acc_counter[ctx_idx]+str_shft]++;
+      hint->second[7+str_shft]++;                                               // total coverage
+    }
+    if (max_pos<last_pos) max_pos=last_pos;                                     // last position of C in acc_map
+  }
+  spit_results;
+  
+  // merging with what was accumulated before
+  remap_entries(*acc_xptr, added,
+                Rcpp::as<std::vector<std::string>>(rname.attr("levels")));
+  acc_xptr->entries = merge_entries(acc_xptr->entries, added);
+  
+  return wrap_accumulator(acc_xptr);
+}
+
+
+// Sums several accumulators into a new one
+// [[Rcpp::export("rcpp_cx_acc_merge")]]
+Rcpp::List rcpp_cx_acc_merge(Rcpp::List &accs)                                  // list of accumulators
+{
+  Rcpp::XPtr<cx_accumulator> res_xptr(new cx_accumulator, true);
+  for (unsigned int a=0; a<accs.size(); a++) {
+    Rcpp::List acc = accs[a];
+    Rcpp::XPtr<cx_accumulator> acc_xptr((SEXP)acc.attr("acc_xptr"));
+    cx_accumulator::T_entries entries(acc_xptr->entries);                       // copy, inputs are not modified
+    remap_entries(*res_xptr, entries, acc_xptr->rname);
+    res_xptr->entries = merge_entries(res_xptr->entries, entries);
+  }
+  return wrap_accumulator(res_xptr);
+}
+
+
+// Writes accumulator to BGZF-compressed file, returns number of positions
+// [[Rcpp::export("rcpp_cx_acc_save")]]
+double rcpp_cx_acc_save(Rcpp::List &acc,                                        // accumulator
+                        std::string fn)                                         // output file name
+{
+  Rcpp::XPtr<cx_accumulator> acc_xptr((SEXP)acc.attr("acc_xptr"));
+  
+  BGZF *fp = bgzf_open(fn.c_str(), "w");                                        // try open file
+  if (!fp) Rcpp::stop("Unable to open accumulator file for writing");           // fall back if error
+  
+  std::string buf;                                                              // output buffer
+  buf.reserve(1<<20);
+  const uint16_t version = 1;
+  const uint32_t nrname = acc_xptr->rname.size();
+  const uint64_t npos = acc_xptr->entries.size();
+  buf.append("EPIACC", 6);
+  buf.append((const char*)&version, sizeof(version));
+  buf.append((const char*)&nrname, sizeof(nrname));
+  for (const std::string &r : acc_xptr->rname) {
+    const uint32_t len = r.size();
+    buf.append((const char*)&len, sizeof(len));
+    buf.append(r);
+  }
+  buf.append((const char*)&npos, sizeof(npos));
+  
+  uint64_t last_key = 0;
+  for (const auto &e : acc_xptr->entries) {
+    put_varint(buf, e.first - last_key);                                        // keys are increasing
+    last_key = e.first;
+    uint16_t mask = 0;
+    for (int k=0; k<16; k++) mask |= (uint16_t)(e.second[k]!=0) << k;           // non-zero counters
+    buf.append((const char*)&mask, sizeof(mask));
+    for (int k=0; k<16; k++) if (e.second[k]) put_varint(buf, e.second[k]);
+    if (buf.size() > (1<<20) - 256) {                                           // flush the buffer
+      if (bgzf_write(fp, buf.data(), buf.size()) < 0) {
+        bgzf_close(fp);
+        Rcpp::stop("Unable to write accumulator file");
+      }
+      buf.clear();
+    }
+  }
+  if (bgzf_write(fp, buf.data(), buf.size()) < 0) {
+    bgzf_close(fp);
+    Rcpp::stop("Unable to write accumulator file");
+  }
+  if (bgzf_close(fp) < 0) Rcpp::stop("Unable to close accumulator file");
+  
+  return npos;
+}
+
+
+// Reads accumulator from BGZF-compressed file
+// [[Rcpp::export("rcpp_cx_acc_load")]]
+Rcpp::List rcpp_cx_acc_load(std::string fn)                                     // input file name
+{
+  BGZF *fp = bgzf_open(fn.c_str(), "r");                                        // try open file
+  if (!fp) Rcpp::stop("Unable to open accumulator file for reading");           // fall back if error
+  
+  Rcpp::XPtr<cx_accumulator> acc_xptr(new cx_accumulator, true);
+#define read_or_stop(ptr, size) {                                                                \
+  if (bgzf_read(fp, ptr, size) != (ssize_t)(size)) {                                             \
+    bgzf_close(fp);                                                                              \
+    Rcpp::stop("Unexpected end of accumulator file");                                            \
+  }                                                                                              \
+}
+
+  char magic[6];
+  uint16_t version;
+  uint32_t nrname;
+  uint64_t npos;
+  read_or_stop(magic, sizeof(magic));
+  read_or_stop(&version, sizeof(version));
+  if (std::string(magic, 6)!="EPIACC" || version!=1) {
+    bgzf_close(fp);
+    Rcpp::stop("Not an accumulator file or unsupported version");
+  }
+  read_or_stop(&nrname, sizeof(nrname));
+  for (uint32_t r=0; r<nrname; r++) {
+    uint32_t len;
+    read_or_stop(&len, sizeof(len));
+    std::string name(len, '\0');
+    read_or_stop(&name[0], len);
+    acc_xptr->rname.push_back(name);
+  }
+  read_or_stop(&npos, sizeof(npos));
+  
+  // number of positions is not trusted: entries grow as they are read, and
+  // truncated or corrupt file stops at the end of the data
+  acc_xptr->entries.reserve(std::min(npos, (uint64_t)1<<20));
+  uint64_t last_key = 0;
+  for (uint64_t n=0; n<npos; n++) {
+    cx_accumulator::T_entries::value_type e;
+    uint16_t mask;
+    last_key += get_varint(fp);
+    e.first = last_key;
+    read_or_stop(&mask, sizeof(mask));
+    for (int k=0; k<16; k++) e.second[k] = (mask >> k) & 1 ? get_varint(fp) : 0;
+    acc_xptr->entries.push_back(e);
+  }
+  bgzf_close(fp);
+  
+  return wrap_accumulator(acc_xptr);
+}
+
+
+// CX report for all the reads in accumulator, same as rcpp_cx_report.
+// Accumulated counts are converted to the layout of CX report counters within
+// windows of successive positions (no more than 2 bp apart when merging
+// strands, so that both cytosines of symmetric context are in the same window)
+// [[Rcpp::export("rcpp_cx_acc_report")]]
+Rcpp::DataFrame rcpp_cx_acc_report(Rcpp::List &acc,                             // accumulator
+                                   const std::string ctx,                       // context string for bases to report
+                                   const bool merge_strands)                    // merge strands of symmetric contexts (CG, CHG)
+{
+  Rcpp::XPtr<cx_accumulator> acc_xptr((SEXP)acc.attr("acc_xptr"));
+  
+  typedef std::array<unsigned int,32> T_val;                                    // layout of CX report counters
+  typedef boost::container::flat_map<cx_accumulator::T_key, T_val> T_cx_fmap;
+  
+// macros
+#define spit_window {                                                                           /* save window counts      */ \
+  for (T_cx_fmap::iterator it=cx_map.begin(); it!=cx_map.end(); it++) {                                                       \
+    for (int s=0; s<2; s++) {                                                                      /* iterate over strands */ \
+      const unsigned int str_shft = s<<4;                                            /* strand shift: 0 for F and 16 for R */ \
+      const unsigned int max_freq_idx = get_major_ctx_idx(it->second, str_shft);                     /* major context or 0 */ \
+      if (ctx_map[max_freq_idx]) {                                                                        /* if within ctx */ \
+        int meth = it->second[max_freq_idx+str_shft];                                                              /* meth */ \
+        int unmeth = it->second[(max_freq_idx+str_shft) | 8];                                                    /* unmeth */ \
+        int out_strand = s+1, out_pos = it->first & 0xFFFFFFFF;                                          /* strand and pos */ \
+        if (merge_strands &&                                                                                 /* if merging */ \
+            merge_sym_strands(cx_map, it, max_freq_idx, s, 16, out_pos, [&] (const auto &mate) {                              \
+              meth += mate[max_freq_idx+16];                                                                 /* merge meth */ \
+              unmeth += mate[(max_freq_idx+16) | 8];                                                       /* merge unmeth */ \
+            }))                                                                                                               \
+          out_strand = 3;                                                                                 /* strand is '*' */ \
+        res_rname.push_back((it->first >> 32) + 1);                                                               /* rname */ \
+        res_strand.push_back(out_strand);                                                                        /* strand */ \
+        res_pos.push_back(out_pos);                                                                                 /* pos */ \
+        res_ctx.push_back(max_freq_idx);                                                                        /* context */ \
+        res_meth.push_back(meth);                                                                                  /* meth */ \
+        res_unmeth.push_back(unmeth);                                                                            /* unmeth */ \
+      }                                                                                                                       \
+    }                                                                                                                         \
+  }                                                                                                                           \
+  cx_map.clear();                                                                                                             \
+};
+
+  // array of contexts to print
+  unsigned int ctx_map [16] = {0};
+  std::for_each(ctx.begin(), ctx.end(), [&ctx_map] (unsigned int const &c) {
+    ctx_map[ctx_to_idx(c)]=1;
+  });
+  
+  // result
+  std::vector<int> res_rname, res_strand, res_pos, res_ctx, res_meth, res_unmeth;
+  
+  T_cx_fmap cx_map;
+  const T_val map_val = {0};
+  const cx_accumulator::T_key max_gap = merge_strands ? 2 : 0;                  // keep both cytosines of symmetric context in the same window
+  for (const auto &e : acc_xptr->entries) {
+    if (!cx_map.empty() &&
+        ((e.first > cx_map.rbegin()->first + max_gap) ||                        // if current position is further downstream
+         ((e.first >> 32) != (cx_map.rbegin()->first >> 32))))                  // or another reference
+      spit_window;
+    T_val &val = cx_map.emplace_hint(cx_map.end(), e.first, map_val)->second;   // entries are sorted
+    for (unsigned int s=0; s<2; s++)                                            // iterate over strands
+      for (int k=0; k<8; k++) val[acc_ctx_idx[k]+(s<<4)] = e.second[k+(s<<3)];  // CX report counters
+  }
+  spit_window;
+  
+  Rcpp::DataFrame res = Rcpp::DataFrame::create(                                // final CX report
+    Rcpp::Named("rname") = res_rname,                                           // numeric ids (factor) for reference names
+    Rcpp::Named("strand") = res_strand,                                         // numeric ids (factor) for reference strands
+    Rcpp::Named("pos") = res_pos,                                               // position of cytosine
+    Rcpp::Named("context") = res_ctx,                                           // cytosine context
+    Rcpp::Named("meth") = res_meth,                                             // number of methylated
+    Rcpp::Named("unmeth") = res_unmeth                                          // number of unmethylated
+  );
+  
+  Rcpp::IntegerVector col_rname = res["rname"];                                 // making rname a factor
+  col_rname.attr("class") = "factor";
+  col_rname.attr("levels") = acc_xptr->rname;
+  
+  Rcpp::IntegerVector col_strand = res["strand"];                               // making strand a factor
+  col_strand.attr("class") = "factor";
+  if (merge_strands)                                                            // merged strands of symmetric contexts are '*'
+    col_strand.attr("levels") = Rcpp::CharacterVector::create("+","-","*");
+  else
+    col_strand.attr("levels") = Rcpp::CharacterVector::create("+","-");
+  
+  Rcpp::CharacterVector contexts = Rcpp::CharacterVector::create(               // base contexts
+    "NA1","CHH","NA3","NA4","NA5","CHG","CG"
+  );
+  Rcpp::IntegerVector col_context = res["context"];                             // making context a factor
+  col_context.attr("class") = "factor";
+  col_context.attr("levels") = contexts;
+  
+  return res;
+}
+
+
+// Sourcing:
+// Rcpp::sourceCpp("rcpp_cx_accumulator.cpp")
@@ -0,0 +1,211 @@
+#include <Rcpp.h>
+#include <array>
+#include <queue>
+#include <functional>
+#include <boost/container/flat_map.hpp>
+#include "epialleleR.h"
+
+// [[Rcpp::plugins(cpp17)]]
+// [[Rcpp::depends(BH)]]
+
+
+// Multi-sample CX matrix, k-way merging, summarising, context-aware
+// PRE-SORTED DATASETS ARE A REQUIREMENT, ALL WITH THE SAME RNAME LEVELS.
+//
+// Takes a list of preprocessed BAM data frames (samples) together with the
+// corresponding read thresholding results, walks all of them at once in
+// (rname, start) order and outputs per-sample methylated and unmethylated
+// counts for every cytosine that is covered by at least min_coverage
+// within-context bases in at least min_samples samples.
+// Output is a list with a data.frame of cytosines (rname, strand, pos, context)
+// and two sparse column-compressed matrices (cytosines x samples) sharing the
+// same structure: row indices (0-based), column pointers and meth/unmeth
+// values. Cells are present only if sample has any within-context base at the
+// cytosine, therefore meth can contain explicit zeros.
+//
+// 1) reads of all samples are merged using min-heap of per-sample cursors
+// 2) XM positions counted in int[32] keyed by pos<<16|sample (as in CX report)
+// 3) when gap in reads (across all samples) or another chr - spit map to res
+// 4) context of the cytosine is the one observed in more than 50% of the reads
+//    of all samples combined
+// 5) triplets are produced row by row and sorted by sample in the end
+//
+// ctx_to_idx conversion is described in epialleleR.h file
+//
+// [[Rcpp::export("rcpp_cx_matrix")]]
+Rcpp::List rcpp_cx_matrix(Rcpp::List &dfs,                                      // list of data frames with BAM data
+                          Rcpp::List &passes,                                   // list of vectors: does it pass the threshold
+                          const std::string ctx,                                // context string for bases to report
+                          const int min_coverage,                               // min number of within-context bases per sample
+                          const int min_samples)                                // min number of samples with min_coverage
+{
+  const unsigned int nsamples = dfs.size();
+  if (nsamples>0xFFFF) Rcpp::stop("Too many samples");
+  
+  // per-sample data
+  std::vector<Rcpp::IntegerVector> rname, strand, start, templid;
+  std::vector<Rcpp::LogicalVector> pass;
+  std::vector<std::vector<std::string>*> seqxm;
+  for (unsigned int s=0; s<nsamples; s++) {
+    Rcpp::DataFrame df = dfs[s];
+    rname.push_back(df["rname"]);                                               // template rname
+    strand.push_back(df["strand"]);                                             // template strand
+    start.push_back(df["start"]);                                               // template start
+    templid.push_back(df["templid"]);                                           // template id, effectively holds indexes of corresponding std::string in std::vector
+    pass.push_back(passes[s]);                                                  // thresholding results
+    Rcpp::XPtr<std::vector<std::string>> seqxm_s((SEXP)df.attr("seqxm_xptr"));  // merged refspaced packed template SEQXMs
+    seqxm.push_back(seqxm_s.get());
+  }
+  
+  // main typedefs
+  typedef uint64_t T_key;                                                       // {48bit:pos, 16bit:sample}
+  typedef std::array<int,32> T_val;                                             // {0:rname, 1:pos, 9:coverage, and 10 more for 11 valid chars * 2 strands}
+  typedef boost::container::flat_map<T_key, T_val> T_cx_fmap;                   // attaboy
+  typedef std::pair<uint64_t, unsigned int> T_cursor;                           // {32bit:rname, 32bit:start}, sample
+  
+  // array of contexts to print
+  unsigned int ctx_map [16] = {0};
+  std::for_each(ctx.begin(), ctx.end(), [&ctx_map] (unsigned int const &c) {
+    ctx_map[ctx_to_idx(c)]=1;
+  });
+  
+  // result
+  std::vector<int> res_rname, res_strand, res_pos, res_ctx;                     // cytosines
+  std::vector<int> res_i, res_j;                                                // row and column of every cell
+  std::vector<double> res_meth, res_unmeth;                                     // values of every cell
+  
+  // min-heap of per-sample cursors, ordered by (rname, start)
+  std::vector<size_t> cur(nsamples, 0);
+  std::priority_queue<T_cursor, std::vector<T_cursor>, std::greater<T_cursor>> heap;
+#define cursor_key(s) (((uint64_t)rname[s][cur[s]] << 32) | (uint32_t)start[s][cur[s]])
+  for (unsigned int s=0; s<nsamples; s++)
+    if (cur[s]<(size_t)rname[s].size()) heap.emplace(cursor_key(s), s);
+
+// macros
+#define spit_results {                                                                          /* save aggregated counts  */ \
+  T_cx_fmap::iterator first = cx_map.begin();                                                                                 \
+  while (first!=cx_map.end()) {                                                                     /* cytosine by cytosine */ \
+    const T_key pos = first->first >> 16;                                                                                     \
+    T_cx_fmap::iterator last = first;                                                                                         \
+    T_val pooled = {0};                                                                              /* all samples combined */ \
+    for (; last!=cx_map.end() && (last->first >> 16)==pos; last++)                                                            \
+      for (int k=0; k<32; k++) pooled[k] += last->second[k];                                                                  \
+    for (int s=0; s<2; s++) {                                                                      /* iterate over strands */ \
+      str_shft = s<<4;                                                               /* strand shift: 0 for F and 16 for R */ \
+      max_freq_idx = get_major_ctx_idx(pooled, str_shft);                      /* context in more than 50% of the reads or 0 */ \
+      if (!ctx_map[max_freq_idx]) continue;                                                           /* if not within ctx */ \
+      int ncovered = 0;                                                                                                       \
+      for (T_cx_fmap::iterator it=first; it!=last; it++)                                                                      \
+        ncovered += (it->second[max_freq_idx+str_shft] + it->second[(max_freq_idx+str_shft) | 8]) >= min_coverage;             \
+      if (ncovered<min_samples) continue;                                                             /* not enough samples */ \
+      const int row = res_pos.size();                                                                                         \
+      res_strand.push_back(s+1);                                                                                 /* strand */ \
+      res_pos.push_back(pos);                                                                                       /* pos */ \
+      res_ctx.push_back(max_freq_idx);                                                                          /* context */ \
+      for (T_cx_fmap::iterator it=first; it!=last; it++) {                                                   /* sample cells */ \
+        const int meth = it->second[max_freq_idx+str_shft];                                                                   \
+        const int unmeth = it->second[(max_freq_idx+str_shft) | 8];                                                           \
+        if (meth+unmeth==0) continue;                                                                      /* not covered */ \
+        res_i.push_back(row);                                                                                                 \
+        res_j.push_back(it->first & 0xFFFF);                                                                                  \
+        res_meth.push_back(meth);                                                                                             \
+        res_unmeth.push_back(unmeth);                                                                                         \
+      }                                                                                                                       \
+    }                                                                                                                         \
+    first = last;                                                                                                             \
+  }                                                                                                                           \
+  res_rname.resize(res_strand.size(), cur_rname);                                                           /* same rname! */ \
+  max_pos=0;                                                                                                                  \
+  cx_map.clear();                                                                                                             \
+  hint = cx_map.end();                                                                                                        \
+};
+
+  // iterating over reads of all samples in order, saving the results when necessary
+  T_cx_fmap cx_map;
+  T_cx_fmap::iterator hint;
+  T_val map_val = {0};
+  int max_pos = 0, cur_rname = 0;
+  unsigned int max_freq_idx, str_shft;
+  
+  cx_map.reserve(100000);
+  for (size_t n=0; !heap.empty(); n++) {
+    // checking for the interrupt
+    if ((n & 0xFFFF) == 0) Rcpp::checkUserInterrupt();                          // every ~65k reads
+    
+    const unsigned int s = heap.top().second;                                   // sample with the leftmost read
+    heap.pop();
+    const size_t x = cur[s]++;                                                  // current read of this sample
+    if (cur[s]<(size_t)rname[s].size()) heap.emplace(cursor_key(s), s);         // next read of this sample
+    
+    const int start_x = start[s][x];                                            // start of the current read
+    if ((start_x>max_pos) || (rname[s][x]!=cur_rname)) {                        // if current position is further downstream or another reference
+      spit_results;
+      cur_rname = rname[s][x];
+      map_val[0] = cur_rname;
+    }
+    str_shft = (strand[s][x]-1)<<4;                                             // strand shift: 0 for F and 16 for R
+    const unsigned int pass_x = (!pass[s][x])<<3;                               // should we lowercase this XM (TRUE==0, FALSE==8)
+    const std::string &seqxm_x = seqxm[s]->at(templid[s][x]);                   // corresponding SEQXM string
+    const char* seqxm_c = seqxm_x.c_str();
+    const unsigned int size_x = seqxm_x.size();                                 // length of the current read
+    for (unsigned int i=0; i<size_x; i++) {                                     // char by char
+      const unsigned int idx_to_increase = unpack_ctx_idx(seqxm_c[i]) | pass_x; // extract lower 4 bits (XM); if not pass -> lowercase
+      if (idx_to_increase==11) continue;                                        // skip +-
+      map_val[1] = start_x+i;
+      hint = cx_map.try_emplace(hint, ((T_key)(map_val[1]) << 16) | s, map_val);
+      hint->second[idx_to_increase+str_shft]++;
+      hint->second[9+str_shft]++;                                               // total coverage
+    }
+    if (max_pos<map_val[1]) max_pos=map_val[1];                                 // last position of C in cx_map
+  }
+  spit_results;
+  
+  // column-compressing: counting sort of cells by sample, rows remain ordered
+  const size_t ncells = res_i.size();
+  std::vector<int> csc_p(nsamples+1, 0);
+  for (size_t c=0; c<ncells; c++) csc_p[res_j[c]+1]++;
+  for (unsigned int s=0; s<nsamples; s++) csc_p[s+1] += csc_p[s];
+  std::vector<int> fill(csc_p.begin(), csc_p.end()-1);
+  Rcpp::IntegerVector csc_i(ncells);
+  Rcpp::NumericVector csc_meth(ncells), csc_unmeth(ncells);
+  for (size_t c=0; c<ncells; c++) {
+    const int dest = fill[res_j[c]]++;
+    csc_i[dest] = res_i[c];
+    csc_meth[dest] = res_meth[c];
+    csc_unmeth[dest] = res_unmeth[c];
+  }
+  
+  Rcpp::DataFrame cytosines = Rcpp::DataFrame::create(                          // cytosines (matrix rows)
+    Rcpp::Named("rname") = res_rname,                                           // numeric ids (factor) for reference names
+    Rcpp::Named("strand") = res_strand,                                         // numeric ids (factor) for reference strands
+    Rcpp::Named("pos") = res_pos,                                               // position of cytosine
+    Rcpp::Named("context") = res_ctx                                            // cytosine context
+  );
+  
+  Rcpp::IntegerVector col_rname = cytosines["rname"];                           // making rname a factor
+  col_rname.attr("class") = "factor";
+  if (nsamples>0) col_rname.attr("levels") = rname[0].attr("levels");
+  
+  Rcpp::IntegerVector col_strand = cytosines["strand"];                         // making strand a factor
+  col_strand.attr("class") = "factor";
+  col_strand.attr("levels") = Rcpp::CharacterVector::create("+","-");
+  
+  Rcpp::CharacterVector contexts = Rcpp::CharacterVector::create(               // base contexts
+    "NA1","CHH","NA3","NA4","NA5","CHG","CG"
+  );
+  Rcpp::IntegerVector col_context = cytosines["context"];                       // making context a factor
+  col_context.attr("class") = "factor";
+  col_context.attr("levels") = contexts;
+  
+  return Rcpp::List::create(
+    Rcpp::Named("cytosines") = cytosines,                                       // rows
+    Rcpp::Named("i") = csc_i,                                                   // 0-based row indices
+    Rcpp::Named("p") = csc_p,                                                   // column pointers
+    Rcpp::Named("meth") = csc_meth,                                             // number of methylated
+    Rcpp::Named("unmeth") = csc_unmeth                                          // number of unmethylated
+  );
+}
+
+
+// Sourcing:
+// Rcpp::sourceCpp("rcpp_cx_matrix.cpp")
@@ -0,0 +1,247 @@
+#include <Rcpp.h>
+#include <array>
+#include <boost/container/flat_map.hpp>
+#include "epialleleR.h"
+
+// [[Rcpp::plugins(cpp17)]]
+// [[Rcpp::depends(BH)]]
+
+// Combined CX and linearized MHL report
+// PRE-SORTED DATASET IS A REQUIREMENT.
+//
+// Does the job of rcpp_cx_report and rcpp_mhl_report in a single pass over the
+// reads: every SEQXM is walked once (plus the lMHL prefill pass) and every
+// position is looked up in the map once. Both sets of counters are kept in the
+// same map value, and both reports are produced exactly as the separate
+// functions would do (context of a cytosine is determined independently for
+// each report, as lMHL skips filtered reads while CX report uses all of them).
+// Output is a list with two data.frames: "cx" and "mhl", see rcpp_cx_report
+// and rcpp_mhl_report for the description of their columns.
+//
+// ctx_to_idx conversion is described in epialleleR.h file
+//
+// [[Rcpp::export("rcpp_cx_mhl_report")]]
+Rcpp::List rcpp_cx_mhl_report(Rcpp::DataFrame &df,                              // data frame with BAM data
+                              Rcpp::LogicalVector &pass,                        // does it pass the threshold (CX report)
+                              const std::string cx_ctx,                         // context string for bases to report (CX report)
+                              const std::string mhl_ctx,                        // context string for bases to report (lMHL report)
+                              const int hmax,                                   // maximum length of a computation window (limit for l in lMHL formula)
+                              const int hmin,                                   // ignore haplotypes smaller than hmin
+                              const double max_ooctx_meth_frac,                 // maximum fraction of methylated to total out-of-context bases (lMHL report)
+                              const bool merge_strands)                         // merge strands of symmetric contexts (CG, CHG)
+{
+  // walking trough bunch of reads <- filling the map
+  // pos -> { 0-31: as in rcpp_cx_report, 32-63: as in rcpp_mhl_report }
+  // boost::container::flat_map<uint64_t, std::array<uint64_t,64>>
+  
+  Rcpp::IntegerVector rname   = df["rname"];                                    // template rname
+  Rcpp::IntegerVector strand  = df["strand"];                                   // template strand
+  Rcpp::IntegerVector start   = df["start"];                                    // template start
+  Rcpp::IntegerVector templid = df["templid"];                                  // template id, effectively holds indexes of corresponding std::string in std::vector
+  
+  Rcpp::XPtr<std::vector<std::string>> seqxm((SEXP)df.attr("seqxm_xptr"));      // merged refspaced packed template SEQXMs, as a pointer to std::vector<std::string>
+  const ctx_hist_view ctxhist(df, *seqxm);                                      // per-template context histograms
+  
+  // main typedefs
+  typedef uint64_t T_key;                                                       // {64bit:pos}
+  typedef std::array<uint64_t,64> T_val;                                        // {0-31: CX counters, 32-63: lMHL counters}
+  typedef boost::container::flat_map<T_key, T_val> T_cx_mhl_map;                // attaboy
+
+// macros
+#define spit_results {                                                                          /* save aggregated counts  */ \
+  for (T_cx_mhl_map::iterator it=cx_mhl_map.begin(); it!=cx_mhl_map.end(); it++) {                                            \
+    for (int s=0; s<2; s++) {                                                                   /* CX: iterate over strands */ \
+      str_shft = s<<4;                                                               /* strand shift: 0 for F and 16 for R */ \
+      max_freq_idx = get_major_ctx_idx(it->second, str_shft);                  /* context in more than 50% of the reads or 0 */ \
+      if (cx_ctx_map[max_freq_idx]) {                                                                     /* if within ctx */ \
+        int meth = it->second[max_freq_idx+str_shft];                                                              /* meth */ \
+        int unmeth = it->second[(max_freq_idx+str_shft) | 8];                                                    /* unmeth */ \
+        int out_strand = s+1, out_pos = it->first;                                                     /* strand and pos */ \
+        if (merge_strands &&                                                                                 /* if merging */ \
+            merge_sym_strands(cx_mhl_map, it, max_freq_idx, s, 16, out_pos, [&] (const auto &mate) {                          \
+              meth += mate[max_freq_idx+16];                                                                 /* merge meth */ \
+              unmeth += mate[(max_freq_idx+16) | 8];                                                       /* merge unmeth */ \
+            }))                                                                                                               \
+          out_strand = 3;                                                                                 /* strand is '*' */ \
+        cx_strand.push_back(out_strand);                                                                         /* strand */ \
+        cx_pos.push_back(out_pos);                                                                                  /* pos */ \
+        cx_ctx_res.push_back(max_freq_idx);                                                                     /* context */ \
+        cx_meth.push_back(meth);                                                                                   /* meth */ \
+        cx_unmeth.push_back(unmeth);                                                                             /* unmeth */ \
+      }                                                                                                                       \
+    }                                                                                                                         \
+    for (int s=0; s<2; s++) {                                                                 /* lMHL: iterate over strands */ \
+      str_shft = 32+(s<<4);                                                         /* strand shift: 32 for F and 48 for R */ \
+      max_freq_idx = get_major_ctx_idx(it->second, str_shft);                  /* context in more than 50% of the reads or 0 */ \
+      if (mhl_ctx_map[max_freq_idx]) {                                                                    /* if within ctx */ \
+        uint64_t cov = it->second[max_freq_idx+str_shft] + it->second[(max_freq_idx+str_shft) | 8];         /* meth + unmeth */ \
+        uint64_t hlen = it->second[8+str_shft];                                                      /* sum of hap sizes */ \
+        uint64_t numer = it->second[3+str_shft], denom = it->second[4+str_shft];                 /* lMHL numerator, denom */ \
+        int out_strand = s+1, out_pos = it->first;                                                     /* strand and pos */ \
+        if (merge_strands &&                                                                                 /* if merging */ \
+            merge_sym_strands(cx_mhl_map, it, max_freq_idx, s, 48, out_pos, [&] (const auto &mate) {                          \
+              cov += mate[max_freq_idx+48] + mate[(max_freq_idx+48) | 8];                                /* merge coverage */ \
+              hlen += mate[8+48];                                                                       /* merge hap sizes */ \
+              numer += mate[3+48];                                                                 /* merge lMHL numerator */ \
+              denom += mate[4+48];                                                               /* merge lMHL denominator */ \
+            }))                                                                                                               \
+          out_strand = 3;                                                                                 /* strand is '*' */ \
+        mhl_strand.push_back(out_strand);                                                                        /* strand */ \
+        mhl_pos.push_back(out_pos);                                                                                 /* pos */ \
+        mhl_ctx_res.push_back(max_freq_idx);                                                                    /* context */ \
+        mhl_cov.push_back(cov);                                                                           /* meth + unmeth */ \
+        mhl_hlen.push_back((double)hlen/cov);                                                          /* average hap size */ \
+        mhl_mhl.push_back((double)numer/denom);                                                                    /* lMHL */ \
+      }                                                                                                                       \
+    }                                                                                                                         \
+  }                                                                                                                           \
+  cx_rname.resize(cx_strand.size(), map_val[0]);                                                            /* same rname! */ \
+  mhl_rname.resize(mhl_strand.size(), map_val[0]);                                                          /* same rname! */ \
+  max_pos=0;                                                                                                                  \
+  cx_mhl_map.clear();                                                                                                         \
+  hint = cx_mhl_map.end();                                                                                                    \
+};
+
+  // arrays of contexts to print
+  unsigned int cx_ctx_map [16] = {0}, mhl_ctx_map [16] = {0};
+  std::for_each(cx_ctx.begin(), cx_ctx.end(), [&cx_ctx_map] (unsigned int const &c) {
+    cx_ctx_map[ctx_to_idx(c)]=1;
+  });
+  std::for_each(mhl_ctx.begin(), mhl_ctx.end(), [&mhl_ctx_map] (unsigned int const &c) {
+    mhl_ctx_map[ctx_to_idx(c)]=1;
+  });
+  
+  // precomputed lMHL numerator lookup table, shared between calls
+  const uint64_t *mhl_lookup = get_mhl_lookup(hmax);
+  
+  // lMHL numerator buffer for current XM
+  std::vector<uint64_t> num_buf(8192);                                          // expandable numerator buffer
+  
+  // results
+  std::vector<int> cx_rname, cx_strand, cx_pos, cx_ctx_res, cx_meth, cx_unmeth;
+  std::vector<int> mhl_rname, mhl_strand, mhl_pos, mhl_ctx_res, mhl_cov;
+  std::vector<double> mhl_hlen, mhl_mhl;
+  
+  // iterating over XM vector, saving the results when necessary
+  T_cx_mhl_map cx_mhl_map;
+  T_cx_mhl_map::iterator hint;
+  T_val map_val = {0};
+  int max_pos = 0;
+  const int max_gap = merge_strands ? 2 : 0;                                    // keep both cytosines of symmetric context in the same map
+  unsigned int max_freq_idx, str_shft;
+  
+  cx_mhl_map.reserve(100000);                                                   // reserving helps?
+  for (unsigned int x=0; x<rname.size(); x++) {
+    // checking for the interrupt
+    if ((x & 0xFFFF) == 0) Rcpp::checkUserInterrupt();                          // every ~65k reads
+    
+    const int start_x = start[x];                                               // start of the current read
+    if ((start_x>max_pos+max_gap) || ((uint64_t)rname[x]!=map_val[0])) {        // if current position is further downstream or another reference
+      spit_results;
+      map_val[0] = rname[x];
+    }
+    str_shft = (strand[x]-1)<<4;                                                // strand shift: 0 for F and 16 for R
+    const unsigned int pass_x = (!pass[x])<<3;                                  // should we lowercase this XM (TRUE==0, FALSE==8)
+    const char* seqxm_x = seqxm->at(templid[x]).c_str();                        // seqxm->at(templid[x]) is a reference to a corresponding SEQXM string
+    const unsigned int size_x = seqxm->at(templid[x]).size();                   // length of the current read
+    
+    // first, filter reads for lMHL using their context histograms
+    size_t h_size;                                                              // total size of haplotype
+    double ooctx_meth_frac;                                                     // fraction of o-o-ctx methylated
+    get_hap_stats(ctxhist[templid[x]], mhl_ctx_map, h_size, ooctx_meth_frac);
+    const bool mhl_x = !((int)h_size<hmin || ooctx_meth_frac>max_ooctx_meth_frac);  // lMHL skips read if haplotype is smaller than hmin or too many o-o-ctx meth bases
+    
+    // then, prefill lMHL numerator buffer in first pass of XM
+    if (mhl_x) {
+      if (num_buf.size() < size_x) num_buf.resize(size_x);                      // expand numerator buffer
+      std::fill_n(num_buf.begin(), size_x, 0);                                  // clean the buffer
+      size_t mh_start = 0, mh_end = 0, mh_size = 0;                             // start, end and size of the current methylated stretch (number of ctx bases)
+      for (unsigned int i=0; i<size_x; i++) {                                   // first pass to compute local lMHL values, char by char
+        const unsigned int base_idx = unpack_ctx_idx(seqxm_x[i]);               // index of current base context; see the table in epialleleR.h
+        if (mhl_ctx_map[base_idx]) {                                            // if within context
+          if (base_idx<8) {                                                     // if uppercase (methylated stretch started/continues)
+            if (!mh_size) mh_start = i;                                         // store start position of methylated stretch
+            mh_end = i;                                                         // store end position of methylated stretch
+            mh_size++;                                                          // methylated stretch size++
+          } else if (mh_size) {                                                 // if lowercase and after non-0-length methylated stretch
+            std::fill(num_buf.begin()+mh_start, num_buf.begin()+mh_end+1, mhl_lookup[std::min(mh_size, MHL_LOOKUP_LEN-1)]);  // set values to nrS(mh_size) within methylated stretch
+            mh_size = 0;                                                        // reset the size
+          }
+        }
+      }
+      if (mh_size) {                                                            // save last non-0-length methylated stretch
+        std::fill(num_buf.begin()+mh_start, num_buf.begin()+mh_end+1, mhl_lookup[std::min(mh_size, MHL_LOOKUP_LEN-1)]);
+      }
+    }
+    const uint64_t denom = mhl_lookup[std::min(h_size, MHL_LOOKUP_LEN-1)];      // lMHL denominator, the same for every position
+    
+    // second, walk through XM once again, filling the map
+    for (unsigned int i=0; i<size_x; i++) {                                     // char by char - it's faster this way than using std::string in the cycle
+      const unsigned int ctx_idx = unpack_ctx_idx(seqxm_x[i]);                  // index of context; see the table in epialleleR.h
+      if (ctx_idx==11) continue;                                                // skip +-
+      map_val[1] = start_x+i;                                                   // current position
+      hint = cx_mhl_map.try_emplace(hint, (T_key)(map_val[1]), map_val);
+      hint->second[(ctx_idx | pass_x)+str_shft]++;                              // CX: if not pass -> lowercase
+      hint->second[9+str_shft]++;                                               // CX: total coverage
+      if (mhl_x) {
+        const unsigned int mhl_shft = 32+str_shft;                              // strand shift: 32 for F and 48 for R
+        hint->second[ctx_idx+mhl_shft]++;
+        hint->second[9+mhl_shft]++;                                             // lMHL: total coverage
+        hint->second[8+mhl_shft] += h_size;                                     // sum haplotype sizes
+        hint->second[3+mhl_shft] += num_buf[i];                                 // lMHL numerator
+        hint->second[4+mhl_shft] += denom;                                      // lMHL denominator
+      }
+    }
+    if ((uint64_t)max_pos<map_val[1]) max_pos=map_val[1];                       // last position of C in cx_mhl_map
+  }
+  spit_results;
+  
+  // final reports
+  Rcpp::CharacterVector contexts = Rcpp::CharacterVector::create(               // base contexts
+    "NA1","CHH","NA3","NA4","NA5","CHG","CG"
+  );
+  
+  Rcpp::DataFrame cx = Rcpp::DataFrame::create(                                 // CX report
+    Rcpp::Named("rname") = cx_rname,                                            // numeric ids (factor) for reference names
+    Rcpp::Named("strand") = cx_strand,                                          // numeric ids (factor) for reference strands
+    Rcpp::Named("pos") = cx_pos,                                                // position of cytosine
+    Rcpp::Named("context") = cx_ctx_res,                                        // cytosine context
+    Rcpp::Named("meth") = cx_meth,                                              // number of methylated
+    Rcpp::Named("unmeth") = cx_unmeth                                           // number of unmethylated
+  );
+  Rcpp::DataFrame mhl = Rcpp::DataFrame::create(                                // lMHL report
+    Rcpp::Named("rname") = mhl_rname,                                           // numeric ids (factor) for reference names
+    Rcpp::Named("strand") = mhl_strand,                                         // numeric ids (factor) for reference strands
+    Rcpp::Named("pos") = mhl_pos,                                               // position of cytosine
+    Rcpp::Named("context") = mhl_ctx_res,                                       // cytosine context
+    Rcpp::Named("coverage") = mhl_cov,                                          // cytosine coverage
+    Rcpp::Named("length") = mhl_hlen,                                           // average haplotype length
+    Rcpp::Named("lmhl") = mhl_mhl                                               // lMHL value
+  );
+  
+  for (Rcpp::DataFrame res : {cx, mhl}) {                                       // factors for both reports
+    Rcpp::IntegerVector col_rname = res["rname"];                               // making rname a factor
+    col_rname.attr("class") = "factor";
+    col_rname.attr("levels") = rname.attr("levels");
+    
+    Rcpp::IntegerVector col_strand = res["strand"];                             // making strand a factor
+    col_strand.attr("class") = "factor";
+    if (merge_strands)                                                          // merged strands of symmetric contexts are '*'
+      col_strand.attr("levels") = Rcpp::CharacterVector::create("+","-","*");
+    else
+      col_strand.attr("levels") = strand.attr("levels");
+    
+    Rcpp::IntegerVector col_context = res["context"];                           // making context a factor
+    col_context.attr("class") = "factor";
+    col_context.attr("levels") = contexts;
+  }
+  
+  return Rcpp::List::create(
+    Rcpp::Named("cx") = cx,
+    Rcpp::Named("mhl") = mhl
+  );
+}
+
+
+// Sourcing:
+// Rcpp::sourceCpp("rcpp_cx_mhl_report.cpp")
@@ -27,13 +27,16 @@
 // 1) all XM positions counted in int[16]: index is equal to char+2>>2&00001111
 // 2) when gap in reads or another chr - spit map to res, clear map
 // 3) spit if within context and same context in more than 50% of the reads
+// 4) if merge_strands: counts of reverse strand CG (CHG) are added to forward
+//    strand counts at pos-1 (pos-2), strand of such cytosines is reported as *
 // 
 // ctx_to_idx conversion is described in epialleleR.h file
 // 
 // [[Rcpp::export("rcpp_cx_report")]]
 Rcpp::DataFrame rcpp_cx_report(Rcpp::DataFrame &df,                             // data frame with BAM data
                                Rcpp::LogicalVector &pass,                       // does it pass the threshold
-                               const std::string ctx)                           // context string for bases to report
+                               const std::string ctx,                           // context string for bases to report
+                               const bool merge_strands)                        // merge strands of symmetric contexts (CG, CHG)
 {
   // walking trough bunch of reads <- filling the map
   // pos -> { 0: rname,  1: pos,       2: 'H',  3: '',    4: '',   5: 'U',  6: 'X',  7: 'Z',  # + strand
@@ -59,22 +62,22 @@ Rcpp::DataFrame rcpp_cx_report(Rcpp::DataFrame &df,
   for (T_cx_fmap::iterator it=cx_map.begin(); it!=cx_map.end(); it++) {                                                       \
     for (int s=0; s<2; s++) {                                                                      /* iterate over strands */ \
       str_shft = s<<4;                                                               /* strand shift: 0 for F and 16 for R */ \
-      if (it->second[9+str_shft]==0) continue;                                                      /* skip if not covered */ \
-      it->second[9+str_shft] /= 2;                                                                   /* halve the coverage */ \
-      if (it->second[12+str_shft] > it->second[9+str_shft]) continue;                                /* skip if most are . */ \
-      else if ((it->second[2+str_shft] + it->second[10+str_shft]) > it->second[9+str_shft])                                   \
-        max_freq_idx=2;                                                                                               /* H */ \
-      else if ((it->second[6+str_shft] + it->second[14+str_shft]) > it->second[9+str_shft])                                   \
-        max_freq_idx=6;                                                                                               /* X */ \
-      else if ((it->second[7+str_shft] + it->second[15+str_shft]) > it->second[9+str_shft])                                   \
-        max_freq_idx=7;                                                                                               /* Z */ \
-      else continue;                                                                              /* skip if none is > 50% */ \
+      max_freq_idx = get_major_ctx_idx(it->second, str_shft);                  /* context in more than 50% of the reads or 0 */ \
       if (ctx_map[max_freq_idx]) {                                                                        /* if within ctx */ \
-        res_strand.push_back(s+1);                                                                               /* strand */ \
-        res_pos.push_back(it->first);                                                                               /* pos */ \
+        int meth = it->second[max_freq_idx+str_shft];                                                              /* meth */ \
+        int unmeth = it->second[(max_freq_idx+str_shft) | 8];                                                    /* unmeth */ \
+        int out_strand = s+1, out_pos = it->first;                                                     /* strand and pos */ \
+        if (merge_strands &&                                                                                 /* if merging */ \
+            merge_sym_strands(cx_map, it, max_freq_idx, s, 16, out_pos, [&] (const auto &mate) {                              \
+              meth += mate[max_freq_idx+16];                                                                 /* merge meth */ \
+              unmeth += mate[(max_freq_idx+16) | 8];                                                       /* merge unmeth */ \
+            }))                                                                                                               \
+          out_strand = 3;                                                                                 /* strand is '*' */ \
+        res_strand.push_back(out_strand);                                                                        /* strand */ \
+        res_pos.push_back(out_pos);                                                                                 /* pos */ \
         res_ctx.push_back(max_freq_idx);                                                                        /* context */ \
-        res_meth.push_back(it->second[max_freq_idx+str_shft]);                                                     /* meth */ \
-        res_unmeth.push_back(it->second[(max_freq_idx+str_shft) | 8]);                                           /* unmeth */ \
+        res_meth.push_back(meth);                                                                                  /* meth */ \
+        res_unmeth.push_back(unmeth);                                                                            /* unmeth */ \
       }                                                                                                                       \
     }                                                                                                                         \
   }                                                                                                                           \
@@ -102,6 +105,7 @@ Rcpp::DataFrame rcpp_cx_report(Rcpp::DataFrame &df,
   T_cx_fmap::iterator hint;
   T_val map_val = {0};
   int max_pos = 0;
+  const int max_gap = merge_strands ? 2 : 0;                                    // keep both cytosines of symmetric context in the same map
   unsigned int max_freq_idx, str_shft;
   
   cx_map.reserve(100000);                                                       // reserving helps?
@@ -110,7 +114,7 @@ Rcpp::DataFrame rcpp_cx_report(Rcpp::DataFrame &df,
     if ((x & 0xFFFF) == 0) Rcpp::checkUserInterrupt();                          // every ~65k reads
     
     const int start_x = start[x];                                               // start of the current read
-    if ((start_x>max_pos) || (rname[x]!=map_val[0])) {                          // if current position is further downstream or another reference
+    if ((start_x>max_pos+max_gap) || (rname[x]!=map_val[0])) {                  // if current position is further downstream or another reference
       spit_results;
       map_val[0] = rname[x];
     }
@@ -145,7 +149,10 @@ Rcpp::DataFrame rcpp_cx_report(Rcpp::DataFrame &df,
   
   Rcpp::IntegerVector col_strand = res["strand"];;                              // making strand a factor
   col_strand.attr("class") = "factor";
-  col_strand.attr("levels") = strand.attr("levels");
+  if (merge_strands)                                                            // merged strands of symmetric contexts are '*'
+    col_strand.attr("levels") = Rcpp::CharacterVector::create("+","-","*");
+  else
+    col_strand.attr("levels") = strand.attr("levels");
   
   Rcpp::CharacterVector contexts = Rcpp::CharacterVector::create(               // base contexts
     "NA1","CHH","NA3","NA4","NA5","CHG","CG"
@@ -0,0 +1,452 @@
+#include <Rcpp.h>
+#include <array>
+#include <fstream>
+#include <cstring>
+#include <boost/container/flat_map.hpp>
+#include <htslib/bgzf.h>
+#include "epialleleR.h"
+
+// [[Rcpp::plugins(cpp17)]]
+// [[Rcpp::depends(BH)]]
+// [[Rcpp::depends(Rhtslib)]]
+
+
+// Methylation tracks, streaming, summarising, context-aware
+// PRE-SORTED DATASET IS A REQUIREMENT.
+//
+// Counts cytosines exactly as rcpp_cx_report does, but instead of collecting
+// the report writes beta values and coverage of cytosines straight to the
+// track files as soon as position map is flushed:
+// 1) bedGraph with beta values (0-based, half-open intervals)
+// 2) bedGraph with coverage (meth+unmeth)
+// 3) binary track (see below)
+// Any of the file names can be empty (no output). Files are BGZF-compressed if
+// their names end with ".gz".
+//
+// Binary track is a BGZF-compressed file with:
+// "EPITRK" magic, uint16 version, uint32 number of reference names, names as
+// uint32 length + chars, then blocks of up to track_block_size records
+// {int32 pos, float beta, uint32 coverage} of the same reference, then the
+// index: uint64 number of blocks and for every block
+// {uint32 rname, int32 first pos, int32 last pos, uint32 nrecs, uint64 offset}.
+// The last data block of the BGZF stream (right before the BGZF EOF block)
+// holds exactly 16 bytes: virtual offset of the index as uint64 and
+// "EPITRKIX" magic. All numbers are little-endian regardless of the platform.
+
+#define track_block_size 4096
+#define track_rec_bytes 12                                                      // serialised size of track_rec
+#define track_index_bytes 24                                                    // serialised size of track_block
+
+// binary track record
+struct track_rec {
+  int32_t pos;
+  float beta;
+  uint32_t coverage;
+};
+
+// binary track block index entry
+struct track_block {
+  uint32_t rname;
+  int32_t first;
+  int32_t last;
+  uint32_t nrecs;
+  uint64_t offset;
+};
+
+// little-endian serialisation of binary track fields
+inline void put_le (std::string &buf, const uint64_t value, const unsigned int size)
+{
+  for (unsigned int b=0; b<size; b++) buf.push_back((char)((value >> (b<<3)) & 0xFF));
+}
+inline uint64_t get_le (const uint8_t *buf, const unsigned int size)
+{
+  uint64_t value = 0;
+  for (unsigned int b=size; b>0; b--) value = (value<<8) | buf[b-1];
+  return value;
+}
+inline void put_rec (std::string &buf, const track_rec &r)
+{
+  uint32_t beta_bits;
+  std::memcpy(&beta_bits, &r.beta, sizeof(beta_bits));                          // IEEE 754 single
+  put_le(buf, (uint32_t)r.pos, 4);
+  put_le(buf, beta_bits, 4);
+  put_le(buf, r.coverage, 4);
+}
+inline track_rec get_rec (const uint8_t *buf)
+{
+  track_rec r;
+  const uint32_t beta_bits = get_le(buf+4, 4);
+  r.pos = (int32_t)get_le(buf, 4);
+  std::memcpy(&r.beta, &beta_bits, sizeof(beta_bits));
+  r.coverage = get_le(buf+8, 4);
+  return r;
+}
+inline void put_index (std::string &buf, const track_block &b)
+{
+  put_le(buf, b.rname, 4);
+  put_le(buf, (uint32_t)b.first, 4);
+  put_le(buf, (uint32_t)b.last, 4);
+  put_le(buf, b.nrecs, 4);
+  put_le(buf, b.offset, 8);
+}
+inline track_block get_index (const uint8_t *buf)
+{
+  return {(uint32_t)get_le(buf, 4), (int32_t)get_le(buf+4, 4),
+          (int32_t)get_le(buf+8, 4), (uint32_t)get_le(buf+12, 4), get_le(buf+16, 8)};
+}
+
+// BGZF handle that is closed when going out of scope, i.e. also when
+// Rcpp::stop or user interrupt unwinds the stack
+struct track_file {
+  BGZF *fp;
+  track_file (BGZF *f) : fp(f) {}
+  track_file (const track_file&) = delete;
+  track_file& operator= (const track_file&) = delete;
+  ~track_file () { if (fp) bgzf_close(fp); }
+  int close () {                                                                // explicit close, reports errors
+    const int res = fp ? bgzf_close(fp) : 0;
+    fp = NULL;
+    return res;
+  }
+  operator BGZF* () const { return fp; }
+  BGZF* operator-> () const { return fp; }
+};
+
+// open BGZF for writing, compressed if file name ends with .gz
+BGZF* track_open (const std::string &fn)
+{
+  const bool gz = fn.size()>3 && fn.compare(fn.size()-3, 3, ".gz")==0;
+  BGZF *fp = bgzf_open(fn.c_str(), gz ? "w" : "wu");
+  if (!fp) Rcpp::stop("Unable to open track file for writing");                 // fall back if error
+  return fp;
+}
+
+// write to BGZF or freak out (file is closed by track_file)
+#define track_write(fp, ptr, size) {                                                           \
+  if (bgzf_write(fp, ptr, size) < 0) Rcpp::stop("Unable to write track file");                 \
+}
+
+// BGZF EOF marker block (SAM/BAM format specification, 4.1.2)
+const uint8_t bgzf_eof_block[28] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 66, 67, 2, 0,
+                                    27, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+// Maximum size of BGZF block holding the 16-byte trailer: deflated 16 bytes
+// take no more than 21 bytes (a stored block), therefore the block is at most
+// 18 (header) + 21 + 8 (CRC32, ISIZE) = 47 bytes long
+#define track_trailer_max_bsize 64
+
+// Virtual offset of the binary track index.
+// Relies on the layout written by rcpp_cx_track: the file ends with the BGZF
+// EOF block, which is preceded by the block holding only the trailer (flushed
+// separately). Such block is found within the last track_trailer_max_bsize
+// bytes before EOF block as the BGZF header with BSIZE matching the distance
+// to EOF block and with ISIZE of 16.
+uint64_t track_index_offset (const std::string &fn)
+{
+  std::ifstream raw(fn, std::ios::binary);                                      // raw file to locate the last block
+  if (!raw) Rcpp::stop("Unable to open track file for reading");
+  raw.seekg(0, std::ios::end);
+  const int64_t fsize = raw.tellg();
+  const int64_t tail_size = std::min(fsize, (int64_t)(track_trailer_max_bsize + sizeof(bgzf_eof_block)));
+  std::vector<uint8_t> tail(tail_size);
+  raw.seekg(fsize-tail_size, std::ios::beg);
+  raw.read((char*)tail.data(), tail_size);
+  if (!raw) Rcpp::stop("Not a track file");
+  raw.close();
+  
+  const int64_t block_end = tail_size - sizeof(bgzf_eof_block);                 // last data block ends where EOF block starts
+  if (block_end<26 ||                                                           // no room for trailer block
+      std::memcmp(tail.data()+block_end, bgzf_eof_block, sizeof(bgzf_eof_block))!=0)
+    Rcpp::stop("Not a track file");
+  int64_t block_start = -1;
+  for (int64_t i=block_end-26; i>=0; i--) {                                     // BGZF header: gzip magic, FEXTRA, "BC" subfield with BSIZE
+    const uint8_t *h = tail.data()+i;
+    if (h[0]==31 && h[1]==139 && h[2]==8 && h[3]==4 && h[12]=='B' && h[13]=='C' &&
+        (int64_t)get_le(h+16, 2) + 1 == block_end - i &&                        // BSIZE is total block size minus 1
+        get_le(tail.data()+block_end-4, 4) == 16) {                             // ISIZE: 16 bytes of trailer
+      block_start = fsize - tail_size + i;
+      break;
+    }
+  }
+  if (block_start<0) Rcpp::stop("Not a track file");
+  
+  track_file fp(bgzf_open(fn.c_str(), "r"));
+  if (!fp) Rcpp::stop("Unable to open track file for reading");
+  uint8_t buf[16];
+  if (bgzf_seek(fp, block_start<<16, SEEK_SET) < 0 ||
+      bgzf_read(fp, buf, sizeof(buf)) != (ssize_t)sizeof(buf) ||
+      std::memcmp(buf+8, "EPITRKIX", 8)!=0)
+    Rcpp::stop("Not a track file");
+  return get_le(buf, 8);
+}
+
+
+// [[Rcpp::export("rcpp_cx_track")]]
+Rcpp::NumericVector rcpp_cx_track(Rcpp::DataFrame &df,                          // data frame with BAM data
+                                  Rcpp::LogicalVector &pass,                    // does it pass the threshold
+                                  const std::string ctx,                        // context string for bases to report
+                                  const bool merge_strands,                     // merge strands of symmetric contexts (CG, CHG)
+                                  const int min_coverage,                       // min coverage of reported cytosines
+                                  const std::string bedgraph_fn,                // bedGraph file for beta values
+                                  const std::string coverage_fn,                // bedGraph file for coverage
+                                  const std::string track_fn)                   // binary track file
+{
+  Rcpp::IntegerVector rname   = df["rname"];                                    // template rname
+  Rcpp::IntegerVector strand  = df["strand"];                                   // template strand
+  Rcpp::IntegerVector start   = df["start"];                                    // template start
+  Rcpp::IntegerVector templid = df["templid"];                                  // template id, effectively holds indexes of corresponding std::string in std::vector
+  
+  Rcpp::XPtr<std::vector<std::string>> seqxm((SEXP)df.attr("seqxm_xptr"));      // merged refspaced packed template SEQXMs, as a pointer to std::vector<std::string>
+  
+  const std::vector<std::string> rname_levels =                                 // reference names
+    Rcpp::as<std::vector<std::string>>(rname.attr("levels"));
+  
+  // main typedefs
+  typedef uint64_t T_key;                                                       // {64bit:pos}
+  typedef std::array<int,32> T_val;                                             // {0:rname, 1:pos, 9:coverage, and 10 more for 11 valid chars * 2 strands}
+  typedef boost::container::flat_map<T_key, T_val> T_cx_fmap;                   // attaboy
+  
+  // output files
+  track_file bg_fp(bedgraph_fn.empty() ? NULL : track_open(bedgraph_fn));
+  track_file cov_fp(coverage_fn.empty() ? NULL : track_open(coverage_fn));
+  track_file trk_fp(track_fn.empty() ? NULL : bgzf_open(track_fn.c_str(), "w")); // binary track is always compressed
+  if (!track_fn.empty() && !trk_fp) Rcpp::stop("Unable to open track file for writing");
+  std::string bin;                                                              // binary track buffer
+  if (trk_fp) {                                                                 // binary track header
+    bin.append("EPITRK", 6);
+    put_le(bin, 2, 2);                                                          // version
+    put_le(bin, rname_levels.size(), 4);
+    for (const std::string &name : rname_levels) {
+      put_le(bin, name.size(), 4);
+      bin.append(name);
+    }
+    track_write(trk_fp, bin.data(), bin.size());
+  }
+  
+  std::vector<track_rec> window;                                                // records of the current window
+  std::vector<track_rec> block;                                                 // records of the current binary track block
+  std::vector<track_block> index;                                               // binary track index
+  std::string line;                                                             // bedGraph line buffer
+  char num_buf[64];
+  double nrecs = 0;                                                             // number of records written
+  block.reserve(track_block_size);
+
+// macros
+#define flush_block {                                                                           /* write binary track block */ \
+  if (trk_fp && !block.empty()) {                                                                                              \
+    index.push_back({(uint32_t)(cur_rname-1), block.front().pos, block.back().pos,                                             \
+                     (uint32_t)block.size(), (uint64_t)bgzf_tell(trk_fp)});                                                   \
+    bin.clear();                                                                                                               \
+    for (const track_rec &r : block) put_rec(bin, r);                                                                          \
+    track_write(trk_fp, bin.data(), bin.size());                                                                               \
+    block.clear();                                                                                                             \
+  }                                                                                                                            \
+};
+#define spit_results {                                                                          /* write aggregated counts */ \
+  for (T_cx_fmap::iterator it=cx_map.begin(); it!=cx_map.end(); it++) {                                                       \
+    for (int s=0; s<2; s++) {                                                                      /* iterate over strands */ \
+      str_shft = s<<4;                                                               /* strand shift: 0 for F and 16 for R */ \
+      max_freq_idx = get_major_ctx_idx(it->second, str_shft);                  /* context in more than 50% of the reads or 0 */ \
+      if (ctx_map[max_freq_idx]) {                                                                        /* if within ctx */ \
+        int meth = it->second[max_freq_idx+str_shft];                                                              /* meth */ \
+        int unmeth = it->second[(max_freq_idx+str_shft) | 8];                                                    /* unmeth */ \
+        int out_pos = it->first;                                                                                      /* pos */ \
+        if (merge_strands)                                                                                   /* if merging */ \
+          merge_sym_strands(cx_map, it, max_freq_idx, s, 16, out_pos, [&] (const auto &mate) {                                \
+            meth += mate[max_freq_idx+16];                                                                   /* merge meth */ \
+            unmeth += mate[(max_freq_idx+16) | 8];                                                         /* merge unmeth */ \
+          });                                                                                                                 \
+        if (meth+unmeth >= min_coverage && meth+unmeth > 0)                                                                   \
+          window.push_back({out_pos, (float)meth/(meth+unmeth), (uint32_t)(meth+unmeth)});                                  \
+      }                                                                                                                       \
+    }                                                                                                                         \
+  }                                                                                                                           \
+  std::stable_sort(window.begin(), window.end(),                                 /* merged R strand cytosines are shifted */ \
+                   [] (const track_rec &a, const track_rec &b) {return a.pos < b.pos;});                                      \
+  for (const track_rec &r : window) {                                                                                         \
+    if (bg_fp || cov_fp) {                                                                                                    \
+      line = cur_rname_str;                                                                                                   \
+      snprintf(num_buf, sizeof(num_buf), "\t%i\t%i\t", r.pos-1, r.pos);                                                       \
+      line += num_buf;                                                                                                        \
+    }                                                                                                                         \
+    if (bg_fp) {                                                                                                              \
+      snprintf(num_buf, sizeof(num_buf), "%g\n", r.beta);                                                                     \
+      std::string bg_line = line + num_buf;                                                                                   \
+      track_write(bg_fp, bg_line.data(), bg_line.size());                                                                     \
+    }                                                                                                                         \
+    if (cov_fp) {                                                                                                             \
+      snprintf(num_buf, sizeof(num_buf), "%u\n", r.coverage);                                                                 \
+      std::string cov_line = line + num_buf;                                                                                  \
+      track_write(cov_fp, cov_line.data(), cov_line.size());                                                                  \
+    }                                                                                                                         \
+    if (trk_fp) {                                                                                                             \
+      block.push_back(r);                                                                                                     \
+      if (block.size()==track_block_size) flush_block;                                                                        \
+    }                                                                                                                         \
+  }                                                                                                                           \
+  nrecs += window.size();                                                                                                     \
+  window.clear();                                                                                                             \
+  max_pos=0;                                                                                                                  \
+  cx_map.clear();                                                                                                             \
+  hint = cx_map.end();                                                                                                        \
+};
+
+  // array of contexts to print
+  unsigned int ctx_map [16] = {0};
+  std::for_each(ctx.begin(), ctx.end(), [&ctx_map] (unsigned int const &c) {
+    ctx_map[ctx_to_idx(c)]=1;
+  });
+  
+  // iterating over XM vector, writing the results when necessary
+  T_cx_fmap cx_map;
+  T_cx_fmap::iterator hint;
+  T_val map_val = {0};
+  int max_pos = 0, cur_rname = 0;
+  std::string cur_rname_str;
+  const int max_gap = merge_strands ? 2 : 0;                                    // keep both cytosines of symmetric context in the same map
+  unsigned int max_freq_idx, str_shft;
+  
+  cx_map.reserve(100000);                                                       // reserving helps?
+  for (unsigned int x=0; x<rname.size(); x++) {
+    // checking for the interrupt
+    if ((x & 0xFFFF) == 0) Rcpp::checkUserInterrupt();                          // every ~65k reads
+    
+    const int start_x = start[x];                                               // start of the current read
+    if ((start_x>max_pos+max_gap) || (rname[x]!=cur_rname)) {                   // if current position is further downstream or another reference
+      spit_results;
+      if (rname[x]!=cur_rname) {                                                // blocks are per reference
+        flush_block;
+        cur_rname = rname[x];
+        cur_rname_str = rname_levels[cur_rname-1];
+      }
+      map_val[0] = rname[x];
+    }
+    str_shft = (strand[x]-1)<<4;                                                // strand shift: 0 for F and 16 for R
+    const unsigned int pass_x = (!pass[x])<<3;                                  // should we lowercase this XM (TRUE==0, FALSE==8)
+    const char* seqxm_x = seqxm->at(templid[x]).c_str();                        // seqxm->at(templid[x]) is a reference to a corresponding SEQXM string
+    const unsigned int size_x = seqxm->at(templid[x]).size();                   // length of the current read
+    for (unsigned int i=0; i<size_x; i++) {                                     // char by char - it's faster this way than using std::string in the cycle
+      const unsigned int idx_to_increase = unpack_ctx_idx(seqxm_x[i]) | pass_x; // extract lower 4 bits (XM); if not pass -> lowercase
+      if (idx_to_increase==11) continue;                                        // skip +-
+      map_val[1] = start_x+i;
+      hint = cx_map.try_emplace(hint, (T_key)(map_val[1]), map_val);
+      hint->second[idx_to_increase+str_shft]++;
+      hint->second[9+str_shft]++;                                               // total coverage
+    }
+    if (max_pos<map_val[1]) max_pos=map_val[1];                                 // last position of C in cx_map
+  }
+  spit_results;
+  flush_block;
+  
+  // closing the files
+  if (bg_fp.close() < 0) Rcpp::stop("Unable to close track file");
+  if (cov_fp.close() < 0) Rcpp::stop("Unable to close track file");
+  if (trk_fp) {
+    const uint64_t index_offset = bgzf_tell(trk_fp);                            // index follows the blocks
+    bin.clear();
+    put_le(bin, index.size(), 8);                                               // number of blocks
+    for (const track_block &b : index) put_index(bin, b);
+    track_write(trk_fp, bin.data(), bin.size());
+    if (bgzf_flush(trk_fp) < 0) Rcpp::stop("Unable to write track file");       // offset goes to its own last block
+    bin.clear();
+    put_le(bin, index_offset, 8);
+    bin.append("EPITRKIX", 8);
+    track_write(trk_fp, bin.data(), bin.size());
+    if (trk_fp.close() < 0) Rcpp::stop("Unable to close track file");
+  }
+  
+  return Rcpp::NumericVector::create(nrecs);
+}
+
+
+// Reads binary track, optionally within a genomic range
+// [[Rcpp::export("rcpp_read_track")]]
+Rcpp::DataFrame rcpp_read_track(std::string fn,                                 // binary track file
+                                std::string region_rname,                       // reference name, or empty for all
+                                int region_start,                               // start of the range
+                                int region_end)                                 // end of the range
+{
+  const uint64_t index_offset = track_index_offset(fn);
+  char magic[8];
+  
+  track_file fp(bgzf_open(fn.c_str(), "r"));                                    // try open file, closed on any exit
+  if (!fp) Rcpp::stop("Unable to open track file for reading");                 // fall back if error
+#define read_or_stop(ptr, size) {                                                                \
+  if (bgzf_read(fp, ptr, size) != (ssize_t)(size))                                               \
+    Rcpp::stop("Unexpected end of track file");                                                  \
+}
+
+#define read_le(var, size) {                                                                     \
+  uint8_t le_buf[8];                                                                             \
+  read_or_stop(le_buf, size);                                                                    \
+  var = get_le(le_buf, size);                                                                    \
+}
+
+  // header
+  uint16_t version;
+  uint32_t nrname;
+  read_or_stop(magic, 6);
+  read_le(version, 2);
+  if (std::string(magic, 6)!="EPITRK" || version!=2)
+    Rcpp::stop("Not a track file or unsupported version");
+  read_le(nrname, 4);
+  std::vector<std::string> rnames;
+  int64_t region_rid = region_rname.empty() ? -1 : -2;                          // -1: all, -2: not found
+  for (uint32_t r=0; r<nrname; r++) {
+    uint32_t len;
+    read_le(len, 4);
+    std::string name(len, '\0');
+    read_or_stop(&name[0], len);
+    if (name==region_rname) region_rid = r;
+    rnames.push_back(name);
+  }
+  
+  // index
+  uint64_t nblocks;
+  if (bgzf_seek(fp, index_offset, SEEK_SET) < 0)
+    Rcpp::stop("Unable to read track file index");
+  read_le(nblocks, 8);
+  std::vector<uint8_t> raw (nblocks*track_index_bytes);                         // serialised index or block
+  read_or_stop(raw.data(), raw.size());
+  std::vector<track_block> index;
+  index.reserve(nblocks);
+  for (uint64_t b=0; b<nblocks; b++) index.push_back(get_index(raw.data() + b*track_index_bytes));
+  
+  // blocks within the range
+  std::vector<int> res_rname, res_pos, res_coverage;
+  std::vector<double> res_beta;
+  for (const track_block &b : index) {
+    if (region_rid==-2) break;                                                  // reference is not in the track
+    if (region_rid>=0 && (b.rname!=region_rid || b.last<region_start || b.first>region_end)) continue;
+    if (bgzf_seek(fp, b.offset, SEEK_SET) < 0)
+      Rcpp::stop("Unable to read track file block");
+    raw.resize((size_t)b.nrecs*track_rec_bytes);
+    read_or_stop(raw.data(), raw.size());
+    for (uint32_t i=0; i<b.nrecs; i++) {
+      const track_rec r = get_rec(raw.data() + i*track_rec_bytes);
+      if (region_rid>=0 && (r.pos<region_start || r.pos>region_end)) continue;
+      res_rname.push_back(b.rname+1);
+      res_pos.push_back(r.pos);
+      res_beta.push_back(r.beta);
+      res_coverage.push_back(r.coverage);
+    }
+  }
+  fp.close();
+  
+  Rcpp::DataFrame res = Rcpp::DataFrame::create(
+    Rcpp::Named("rname") = res_rname,                                           // numeric ids (factor) for reference names
+    Rcpp::Named("pos") = res_pos,                                               // position of cytosine
+    Rcpp::Named("beta") = res_beta,                                             // beta value
+    Rcpp::Named("coverage") = res_coverage                                      // number of methylated + unmethylated
+  );
+  
+  Rcpp::IntegerVector col_rname = res["rname"];                                 // making rname a factor
+  col_rname.attr("class") = "factor";
+  col_rname.attr("levels") = rnames;
+  
+  return res;
+}
+
+
+// Sourcing:
+// Rcpp::sourceCpp("rcpp_cx_track.cpp")
@@ -4,15 +4,38 @@
 #include <Rcpp.h>
 #include <boost/container/flat_map.hpp>
 #include <cinttypes>
+#include <climits>
+#include <cstring>
+#include <unordered_map>
 #include <htslib/hts.h>
 #include "epialleleR.h"
 // using namespace Rcpp;
 
 // Scans trough reads and extracts methylation patterns from the reads that
-// overlap target area. Clips overhangs if necessary.
-// Return value: a data frame with the following columns:
+// overlap target areas. Clips overhangs if necessary.
+// Return value: a list of data frames (one per target) with the following
+// columns:
 // 1) pattern id (FNV hash)
 // 2) just read the epialleleR::extractPatterns() manual...
+//
+// Batched: reads are sorted by rname and start, therefore for every target
+// only reads within [target_start - max read length, target_end] are scanned
+// (found by binary search). Targets are processed in parallel, each with its
+// own pattern maps. If reads happen to be unsorted, all of them are scanned
+// for every target.
+//
+// Optionally, identical patterns are collapsed right here: patterns are keyed
+// by word-at-a-time hash of their positions and bases (confirmed by comparing
+// positions and bases on a hash hit), and only unique patterns with their
+// counts are returned (without strand, start and end,
+// which are read-specific). FNV-1a IDs are computed once per unique pattern
+// and are the same as in per-read output.
+//
+// Optionally, within-context bases are returned as a compact bit-packed
+// matrix instead of a data frame of per-position factors: 2-bit codes (0 for
+// absent, 1 for unmethylated, 2 for methylated), four patterns per byte,
+// column-major with every column (position) starting at a byte boundary.
+// Highlighted bases are not included in such matrix.
 
 // described in epialleleR.h file:
 //   ctx_to_idx conversion
@@ -22,190 +45,357 @@
 // [[Rcpp::plugins(cpp17)]]
 // [[Rcpp::depends(BH)]]
 
-// fast, vectorised
-// [[Rcpp::export("rcpp_extract_patterns")]]
-Rcpp::DataFrame rcpp_extract_patterns(Rcpp::DataFrame &df,                      // data frame with BAM data
-                                      const unsigned int target_rname,          // target chromosome
-                                      const unsigned int target_start,          // target start
-                                      const unsigned int target_end,            // target end
-                                      const signed int min_overlap,             // min overlap of reads and capture targets
-                                      const std::string ctx,                    // context string for bases to include
-                                      const double min_ctx_freq,                // minimum frequency of observed context at position
-                                      const bool clip,                          // clip the matched reads to target area
-                                      const unsigned int reverse_offset,        // decrease reverse strand coordinates by this value: 0 for CHH, 1 for CpG, 2 for CHG
-                                      Rcpp::IntegerVector &hlght) {             // positions of bases to extract sequence info; NB: overlapping, unique and sorted!
-  Rcpp::IntegerVector rname   = df["rname"];                                    // template rname
-  Rcpp::IntegerVector strand  = df["strand"];                                   // template strand
-  Rcpp::IntegerVector start   = df["start"];                                    // template start
-  Rcpp::IntegerVector templid = df["templid"];                                  // template id, effectively holds indexes of corresponding std::string in std::vector
-  
-  Rcpp::XPtr<std::vector<std::string>> seqxm((SEXP)df.attr("seqxm_xptr"));      // merged refspaced packed template SEQXMs, as a pointer to std::vector<std::string>
+// map key and value
+typedef int T_key;
+typedef std::vector<int> T_val;
+struct T_column {
+  unsigned int idx;                                                             // column index in packed matrix, or UINT_MAX for highlighted
+  T_val bases;                                                                  // bases, empty if packed
+};
+typedef std::map<T_key, T_column> T_pat_map;
+
+// Patterns of a single target, filled without any calls to R API
+struct T_patterns {
+  T_pat_map pat_map;                                                            // per-position bases (including highlighted ones)
+  std::vector<int> strand, start, end, nbase;                                   // pattern strands, starts, ends, number of bases within context
+  std::vector<double> beta;                                                     // pattern betas
+  std::vector<uint64_t> fnv;                                                    // FNV-1a hashes of patterns
+  std::vector<int> count;                                                       // number of reads per unique pattern
+  std::vector<uint8_t> packed;                                                  // packed matrix of within-context bases
+};
+
+// Base of the current pattern
+struct T_base {
+  T_column *column;                                                             // map value to store the base in
+  unsigned int pos;                                                             // position of the base
+  unsigned int base;                                                            // context or sequence index
+};
 
-  // consts, vars, typedefs
+// extracts patterns of one target from reads [first, last)
+void extract_patterns(const int *rname, const int *strand, const int *start,
+                      const int *templid, const std::vector<std::string> &seqxm,
+                      const size_t first, const size_t last,
+                      const unsigned int target_rname,
+                      const unsigned int target_start,
+                      const unsigned int target_end,
+                      const signed int min_overlap,
+                      const unsigned int *ctx_map,
+                      const double min_ctx_freq,
+                      const bool clip,
+                      const unsigned int reverse_offset,
+                      const std::vector<int> &hlght,                            // NB: overlapping, unique and sorted!
+                      const bool summarize,                                     // unique patterns with counts instead of per-read ones
+                      const bool pack,                                          // packed matrix instead of per-position bases
+                      T_patterns &res)
+{
+  // consts, vars
   const uint64_t offset_basis = FNV1a_OFFSET_BASIS;                             // FNV-1a offset basis
   const unsigned int factor_map[] = { 13, 3, 4, 13, 11, 13, 13, 13, 12, 13, 13, 13, 13, 13, 13, 13 };  // factor indices for bases "=ACMGRSVTWYHKDBN"
   unsigned int npat = 0;                                                        // pattern counter
-  typedef int T_key;                                                            // map key
-  typedef std::vector<int> T_val;                                               // map value
   boost::container::flat_map<T_key, T_key> pos_map;                             // all positions to figure out valid ones
   boost::container::flat_map<T_key, T_key>::iterator pos_hint = pos_map.begin();// position map iterator
-  std::map<T_key, T_val> pat_map;                                               // per-pattern methylation counts
-  std::map<T_key, T_val> hlght_map;                                             // per-pattern sequence bases
-  std::vector<int> pat_strand, pat_start, pat_end, pat_nbase;                   // pattern strands, starts, ends, number of bases within context
-  std::vector<double> pat_beta;                                                 // pattern betas
-  std::vector<std::string> pat_fnv;                                             // FNV-1a hashes of patterns
+  T_pat_map &pat_map = res.pat_map;                                             // per-pattern methylation counts
+  T_pat_map hlght_map;                                                          // per-pattern sequence bases
   
-  pos_map.reserve(std::max((int)(target_end-target_start), 0xFFFF));
-  
-  // filling the context map
-  unsigned int ctx_map [16] = {0};
-  std::for_each(ctx.begin(), ctx.end(), [&ctx_map] (unsigned int const &c) {
-    ctx_map[ctx_to_idx(c)]=1;
-  });
-  
-  // // rnames are sorted, should've been taking an advantage of it...
-  // Rcpp::IntegerVector::const_iterator lower = std::lower_bound(rname.begin(), rname.end(), target_rname);
-  // Rcpp::IntegerVector::const_iterator upper = std::upper_bound(lower, rname.end(), target_rname);
-  // for (unsigned int x=lower-rname.begin(); x<upper-rname.begin(); x++) {
-  
-  // first - find valid positions
-  for (unsigned int x=0; x<rname.size(); x++) {   
-    // checking for the interrupt
-    if ((x & 0xFFFF) == 0) Rcpp::checkUserInterrupt();                          // check for interrupt
-    
-    if (rname[x]==(int)target_rname) {
-      const unsigned int size_x = seqxm->at(templid[x]).size();                 // length of the current read
+  // the same for both passes: calls f(x, start_x, begin_i, end_i) for every
+  // read overlapping the target
+  auto for_each_read = [&] (auto f) {
+    for (size_t x=first; x<last; x++) {
+      if (rname[x]!=(int)target_rname) continue;
+      const unsigned int size_x = seqxm[templid[x]].size();                     // length of the current read
       const unsigned int start_x = start[x];                                    // start position of the current read
       const unsigned int end_x = start_x + size_x - 1;                          // end position of the current read
       const unsigned int over_start_x = std::max(start_x, target_start);        // start of overlapped area
       const unsigned int over_end_x = std::min(end_x, target_end);              // end of overlapped area
       const signed int overlap = over_end_x - over_start_x + 1;                 // overlap with target
       if (overlap>=min_overlap) {                                               // if overlaps the target
-        const char* seqxm_x = seqxm->at(templid[x]).c_str();                    // seqxm->at(templid[x]) is a reference to a corresponding SEQXM string
-        const unsigned int offset_x = strand[x]==2 ? reverse_offset : 0;        // offset coordinates of reverse strand for symmetric methylation
         const unsigned int begin_i = clip ? (over_start_x - start_x) : 0;       // clip the XM?
         const unsigned int end_i = clip ? overlap : size_x;                     // clip the XM?
-        for (unsigned int i=begin_i; i<end_i; i++) {                            // char by char - it's faster this way than using std::string in the cycle
-          if (ctx_map[unpack_ctx_idx(seqxm_x[i])]) {                            // if base is within context
-            const unsigned int pos = start_x + i - offset_x;                    // position of the base
-            pos_hint = pos_map.try_emplace(pos_hint, pos, 0);                   // check if this position is already included, emplace if not
-            pos_hint->second++;                                                 // position++
-          }
-        }
-        npat++;                                                                 // patterns++, to know how many
+        f(x, start_x, begin_i, end_i);
       }
     }
-  }
+  };
+  
+  // first - find valid positions
+  for_each_read([&] (const size_t x, const unsigned int start_x,
+                     const unsigned int begin_i, const unsigned int end_i) {
+    const char* seqxm_x = seqxm[templid[x]].c_str();                            // seqxm[templid[x]] is a reference to a corresponding SEQXM string
+    const unsigned int offset_x = strand[x]==2 ? reverse_offset : 0;            // offset coordinates of reverse strand for symmetric methylation
+    for (unsigned int i=begin_i; i<end_i; i++) {                                // char by char - it's faster this way than using std::string in the cycle
+      if (ctx_map[unpack_ctx_idx(seqxm_x[i])]) {                                // if base is within context
+        const unsigned int pos = start_x + i - offset_x;                        // position of the base
+        pos_hint = pos_map.try_emplace(pos_hint, pos, 0);                       // check if this position is already included, emplace if not
+        pos_hint->second++;                                                     // position++
+      }
+    }
+    npat++;                                                                     // patterns++, to know how many
+  });
   
   // fill pattern map
+  const T_val empty (pack ? 0 : npat, NA_INTEGER);                              // no per-position bases if packed
+  unsigned int ncol = 0;                                                        // number of within-context positions
   for (auto it=pos_map.begin(); it!=pos_map.end(); it++) {
     if (((double)it->second/npat >= min_ctx_freq) &&                            // if position frequency in patterns is higher than the min
         (std::find(hlght.begin(), hlght.end(), it->first) == hlght.end()))      // and it's not the highlighted position
-      pat_map.emplace(it->first, T_val (npat, NA_INTEGER));                     // add position to the pattern map
+      pat_map.emplace(it->first, T_column {ncol++, empty});                     // add position to the pattern map
   }
   // fill highlight map
   for (unsigned int i=0; i<hlght.size(); i++) {
-    hlght_map.emplace(hlght[i], T_val (npat, NA_INTEGER));                      // add position to the highlight map
+    hlght_map.emplace(hlght[i], T_column {UINT_MAX, empty});                    // add position to the highlight map
   }
+  // packed matrix, with stride for as many patterns as there are reads
+  size_t stride = ((size_t)npat + 3) / 4;
+  if (pack) res.packed.assign(ncol * stride, 0);
   
   npat = 0;
-  for (unsigned int x=0; x<rname.size(); x++) {   
-    // checking for the interrupt
-    if ((x & 0xFFFF) == 0) Rcpp::checkUserInterrupt();                          // check for interrupt
-    
-    if (rname[x]==(int)target_rname) {
-      const unsigned int size_x = seqxm->at(templid[x]).size();                 // length of the current read
-      const unsigned int start_x = start[x];                                    // start position of the current read
-      const unsigned int end_x = start_x + size_x - 1;                          // end position of the current read
-      const unsigned int over_start_x = std::max(start_x, target_start);        // start of overlapped area
-      const unsigned int over_end_x = std::min(end_x, target_end);              // end of overlapped area
-      const signed int overlap = over_end_x - over_start_x + 1;                 // overlap with target
-      if (overlap>=min_overlap) {                                               // if overlaps the target
-        const char* seqxm_x = seqxm->at(templid[x]).c_str();                    // seqxm->at(templid[x]) is a reference to a corresponding SEQXM string
-        const unsigned int offset_x = strand[x]==2 ? reverse_offset : 0;        // offset coordinates of reverse strand for symmetric methylation
-        const unsigned int begin_i = clip ? (over_start_x - start_x) : 0;       // clip the XM?
-        const unsigned int end_i = clip ? overlap : size_x;                     // clip the XM?
-        unsigned int meth = 0, total = 0;                                       // counters for methylated and total within context
-        uint64_t fnv = offset_basis;                                            // FNV-1a hash of current pattern
-        for (unsigned int i=begin_i; i<end_i; i++) {                            // char by char - it's faster this way than using std::string in the cycle
-          const unsigned int base = unpack_ctx_idx(seqxm_x[i]);                 // index of a context
-          if (ctx_map[base]) {                                                  // if base is within context
-            const unsigned int pos = start_x + i - offset_x;                    // position of the base
-            auto hint = pat_map.find(pos);                                      // find and check if this position is already included
-            if (hint != pat_map.end()) {
-              hint->second[npat] = base;                                        // save base by position
-              meth += !(base & 8);                                              // methylated + (0 for lowercase, 1 for uppercase)
-              total++;                                                          // total++
-              fnv_add(fnv, reinterpret_cast<const char*>(&pos), sizeof(pos));   // FNV-1a: add int position
-              fnv_add(fnv, &base, sizeof(char));                                // FNV-1a: add context index
-            }
-          }
+  std::vector<T_base> bases;                                                    // within-pattern bases of the current read
+  std::vector<uint64_t> keys;                                                   // hashed positions and bases of the current read
+  std::unordered_multimap<uint64_t, unsigned int> pat_idx;                      // unique patterns: hash to index
+  std::vector<uint64_t> pat_keys;                                               // hashed positions and bases of unique patterns, concatenated
+  std::vector<size_t> pat_off (1, 0);                                           // offsets of unique patterns in pat_keys
+  for_each_read([&] (const size_t x, const unsigned int start_x,
+                     const unsigned int begin_i, const unsigned int end_i) {
+    const char* seqxm_x = seqxm[templid[x]].c_str();                            // seqxm[templid[x]] is a reference to a corresponding SEQXM string
+    const unsigned int offset_x = strand[x]==2 ? reverse_offset : 0;            // offset coordinates of reverse strand for symmetric methylation
+    unsigned int meth = 0;                                                      // counter for methylated within context
+    uint64_t hash = HASH64_SEED;                                                // fast hash of current pattern
+    bases.clear();
+    keys.clear();
+    for (unsigned int i=begin_i; i<end_i; i++) {                                // char by char - it's faster this way than using std::string in the cycle
+      const unsigned int base = unpack_ctx_idx(seqxm_x[i]);                     // index of a context
+      if (ctx_map[base]) {                                                      // if base is within context
+        const unsigned int pos = start_x + i - offset_x;                        // position of the base
+        auto hint = pat_map.find(pos);                                          // find and check if this position is already included
+        if (hint != pat_map.end()) {
+          bases.push_back({&hint->second, pos, base});                          // save base by position
+          meth += !(base & 8);                                                  // methylated + (0 for lowercase, 1 for uppercase)
+          keys.push_back(((uint64_t)pos << 8) | base);                          // position and context index
+          hash64_add(hash, keys.back());                                        // hash: add them
         }
-        
-        if (fnv != offset_basis) {                                              // only if nonempty, valid pattern
-          // extract bases to highlight
-          for (unsigned int i=0; i<hlght.size(); i++) {                         // for every position to highlight
-            const unsigned int hlght_pos = hlght[i] - start_x;
-            if ( ((hlght_pos >= begin_i) && (hlght_pos < end_i)) ) {            // if position within pattern
-              const unsigned int base = factor_map[unpack_seq_idx(seqxm_x[hlght_pos])]; // see comments on base factors at the top
-              auto hint = hlght_map.find(hlght[i]);                             // find this position
-              hint->second[npat] = base;                                        // save base by position
-              fnv_add(fnv, reinterpret_cast<char*>(&hlght[i]), sizeof(hlght[i])); // FNV-1a: add int position
-              fnv_add(fnv, &base, sizeof(char));                                // FNV-1a: add sequence index
-            }
-          }
-          
-          // save pattern info
-          npat++;                                                               // patterns++
-          pat_strand.push_back(strand[x]);                                      // push strand
-          pat_start.push_back(start_x+begin_i);                                 // push start
-          pat_end.push_back(start_x+end_i-1);                                   // push end
-          pat_nbase.push_back(total);                                           // push total
-          pat_beta.push_back((double)meth/total);                               // push beta
-          char fnv_str[17] = {'0'};
-          snprintf(fnv_str, 17, "%.16" PRIX64, fnv);
-          pat_fnv.emplace_back(fnv_str, 16);                                    // push FNV-1a hash
+      }
+    }
+    const unsigned int total = bases.size();                                    // total within context
+    if (!total) return;                                                         // only nonempty, valid patterns
+    
+    // extract bases to highlight
+    for (unsigned int i=0; i<hlght.size(); i++) {                               // for every position to highlight
+      const unsigned int hlght_pos = hlght[i] - start_x;
+      if ( ((hlght_pos >= begin_i) && (hlght_pos < end_i)) ) {                  // if position within pattern
+        const unsigned int base = factor_map[unpack_seq_idx(seqxm_x[hlght_pos])]; // see comments on base factors at the top
+        bases.push_back({&hlght_map.find(hlght[i])->second, (unsigned int)hlght[i], base}); // save base by position
+        keys.push_back(((uint64_t)hlght[i] << 8) | 0x10 | base);                // position and sequence index
+        hash64_add(hash, keys.back());                                          // hash: add them
+      }
+    }
+    
+    if (summarize) {
+      const auto range = pat_idx.equal_range(hash);
+      for (auto it=range.first; it!=range.second; it++) {                       // hash hit: compare with the first occurrence
+        const unsigned int idx = it->second;
+        if (std::equal(keys.begin(), keys.end(),
+                       pat_keys.begin() + pat_off[idx],
+                       pat_keys.begin() + pat_off[idx+1])) {                    // already seen, just count it
+          res.count[idx]++;
+          return;
         }
       }
+      pat_idx.emplace(hash, npat);                                              // new pattern (or hash collision)
+      pat_keys.insert(pat_keys.end(), keys.begin(), keys.end());
+      pat_off.push_back(pat_keys.size());
+      res.count.push_back(1);                                                   // push count
+    } else {
+      res.strand.push_back(strand[x]);                                          // push strand
+      res.start.push_back(start_x+begin_i);                                     // push start
+      res.end.push_back(start_x+end_i-1);                                       // push end
     }
-  }
+    
+    // save pattern info
+    uint64_t fnv = offset_basis;                                                // FNV-1a hash of current pattern
+    for (const T_base &b : bases) {
+      if (!pack) {
+        b.column->bases[npat] = b.base;                                         // save base by position
+      } else if (b.column->idx!=UINT_MAX) {
+        res.packed[b.column->idx*stride + npat/4] |=                            // save 2-bit methylation status by position
+          (b.base & 8 ? 1 : 2) << ((npat & 3) << 1);
+      }
+      fnv_add(fnv, reinterpret_cast<const char*>(&b.pos), sizeof(b.pos));       // FNV-1a: add int position
+      fnv_add(fnv, &b.base, sizeof(char));                                      // FNV-1a: add context or sequence index
+    }
+    npat++;                                                                     // patterns++
+    res.nbase.push_back(total);                                                 // push total
+    res.beta.push_back((double)meth/total);                                     // push beta
+    res.fnv.push_back(fnv);                                                     // push FNV-1a hash
+  });
   
-  if (!npat) return Rcpp::DataFrame::create();                                  // return empty DataFrame if no patterns were found
+  if (pack) {                                                                   // we reserved more, cutting off unused bytes now
+    const size_t new_stride = ((size_t)npat + 3) / 4;
+    for (size_t c=1; c<ncol && new_stride<stride; c++)
+      std::memmove(res.packed.data() + c*new_stride, res.packed.data() + c*stride, new_stride);
+    res.packed.resize(ncol * new_stride);
+    return;
+  }
   
   pat_map.merge(hlght_map);                                                     // merge pattern map and highlight map
-  
   for (auto it=pat_map.begin(); it!=pat_map.end(); it++) {                      // we reserved more, cutting off NA values now
-    it->second.resize(npat);
+    it->second.bases.resize(npat);
   }
-  Rcpp::DataFrame res = Rcpp::wrap(pat_map);                                    // wrap pattern map into DataFrame
+}
+
+
+// fast, vectorised, batched
+// [[Rcpp::export("rcpp_extract_patterns")]]
+Rcpp::List rcpp_extract_patterns(Rcpp::DataFrame &df,                           // data frame with BAM data
+                                 std::vector<int> target_rname,                 // target chromosomes
+                                 std::vector<int> target_start,                 // target starts
+                                 std::vector<int> target_end,                   // target ends
+                                 const signed int min_overlap,                  // min overlap of reads and capture targets
+                                 const std::string ctx,                         // context string for bases to include
+                                 const double min_ctx_freq,                     // minimum frequency of observed context at position
+                                 const bool clip,                               // clip the matched reads to target area
+                                 const unsigned int reverse_offset,             // decrease reverse strand coordinates by this value: 0 for CHH, 1 for CpG, 2 for CHG
+                                 Rcpp::List &hlght,                             // per target positions of bases to extract sequence info; NB: overlapping, unique and sorted!
+                                 const bool summarize,                          // unique patterns with counts instead of per-read ones
+                                 const bool pack,                               // packed matrix instead of per-position bases
+                                 int nthreads) {                                // number of threads
+  Rcpp::IntegerVector rname   = df["rname"];                                    // template rname
+  Rcpp::IntegerVector strand  = df["strand"];                                   // template strand
+  Rcpp::IntegerVector start   = df["start"];                                    // template start
+  Rcpp::IntegerVector templid = df["templid"];                                  // template id, effectively holds indexes of corresponding std::string in std::vector
+  
+  Rcpp::XPtr<std::vector<std::string>> seqxm((SEXP)df.attr("seqxm_xptr"));      // merged refspaced packed template SEQXMs, as a pointer to std::vector<std::string>
+  
+  const size_t ntargets = target_rname.size();
+  if (target_start.size()!=ntargets || target_end.size()!=ntargets ||
+      (size_t)hlght.size()!=ntargets)
+    Rcpp::stop("Target vectors must be of the same length");
+  
+  // filling the context map
+  unsigned int ctx_map [16] = {0};
+  std::for_each(ctx.begin(), ctx.end(), [&ctx_map] (unsigned int const &c) {
+    ctx_map[ctx_to_idx(c)]=1;
+  });
+  
+  // highlighted positions, outside of R API
+  std::vector<std::vector<int>> hlght_pos (ntargets);
+  for (size_t t=0; t<ntargets; t++)
+    hlght_pos[t] = Rcpp::as<std::vector<int>>(hlght[t]);
   
+  // raw pointers for threads
+  const int *rname_x = rname.begin();
+  const int *strand_x = strand.begin();
+  const int *start_x = start.begin();
+  const int *templid_x = templid.begin();
+  const size_t nreads = rname.size();
+  
+  // reads are expected to be sorted by rname and start; longest read tells
+  // how far before the target start the overlapping reads may begin
+  bool sorted = true;
+  long long max_size = 0;
+  for (size_t x=0; x<nreads; x++) {
+    if (x>0 && (rname_x[x]<rname_x[x-1] ||
+                (rname_x[x]==rname_x[x-1] && start_x[x]<start_x[x-1])))
+      sorted = false;
+    max_size = std::max(max_size, (long long)seqxm->at(templid_x[x]).size());
+  }
+  
+  // targets in parallel
+  std::vector<T_patterns> patterns (ntargets);
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+  for (int t=0; t<(int)ntargets; t++) {
+    if (target_rname[t]==NA_INTEGER) continue;                                  // rname is not in BAM
+    size_t first = 0, last = nreads;
+    if (sorted) {
+      first = first_read(rname_x, start_x, nreads, target_rname[t], (long long)target_start[t] - max_size + 1);
+      last = first_read(rname_x, start_x, nreads, target_rname[t], (long long)target_end[t] + 1);
+    }
+    extract_patterns(rname_x, strand_x, start_x, templid_x, *seqxm, first, last,
+                     target_rname[t], target_start[t], target_end[t],
+                     min_overlap, ctx_map, min_ctx_freq, clip, reverse_offset,
+                     hlght_pos[t], summarize, pack, patterns[t]);
+  }
+  
+  // wrapping, serially
   Rcpp::CharacterVector contexts = Rcpp::CharacterVector::create(               // base contexts
     "NA1", "H", "A", "C", "NA5","X", "Z", "NA8",
     "NA9", "h", "G", "T", "N",  "x", "z","NA16"
   );
-  for (int i=0; i<res.length(); i++) {                                          // context factor for every column
-    Rcpp::IntegerVector column = res[i];
-    column.attr("class") = "factor";
-    column.attr("levels") = contexts;
+  Rcpp::List res (ntargets);
+  for (size_t t=0; t<ntargets; t++) {
+    T_patterns &pat = patterns[t];
+    const unsigned int npat = pat.fnv.size();
+    if (!npat && !pack) {                                                       // empty DataFrame if no patterns were found
+      res[t] = Rcpp::DataFrame::create();
+      continue;
+    }
+    
+    // columns: seqnames, [strand, start, end,] nbase, beta, pattern, [count,]
+    // and then per-position bases as factors (if not packed)
+    const size_t ncols = (summarize ? 5 : 7) + (pack ? 0 : pat.pat_map.size());
+    Rcpp::List pat_df (ncols);
+    Rcpp::CharacterVector pat_names (ncols);
+    size_t c = 0;
+    auto add_column = [&] (const std::string &name, SEXP column) {
+      pat_df[c] = column;                                                       // protect the column first
+      pat_names[c++] = name;
+    };
+    
+    Rcpp::IntegerVector pat_rname(npat, target_rname[t]);                       // rname factor (size, value)
+    pat_rname.attr("class") = rname.attr("class");
+    pat_rname.attr("levels") = rname.attr("levels");
+    add_column("seqnames", pat_rname);
+    
+    if (!summarize) {
+      Rcpp::IntegerVector col_strand = Rcpp::wrap(pat.strand);                  // strand factor
+      col_strand.attr("class") = strand.attr("class");
+      col_strand.attr("levels") = strand.attr("levels");
+      add_column("strand", col_strand);
+      add_column("start", Rcpp::wrap(pat.start));
+      add_column("end", Rcpp::wrap(pat.end));
+    }
+    add_column("nbase", Rcpp::wrap(pat.nbase));
+    add_column("beta", Rcpp::wrap(pat.beta));
+    
+    std::vector<std::string> pat_fnv;                                           // FNV-1a hashes of patterns
+    pat_fnv.reserve(npat);
+    for (unsigned int i=0; i<npat; i++) {
+      char fnv_str[17] = {'0'};
+      snprintf(fnv_str, 17, "%.16" PRIX64, pat.fnv[i]);
+      pat_fnv.emplace_back(fnv_str, 16);
+    }
+    add_column("pattern", Rcpp::wrap(pat_fnv));
+    if (summarize) add_column("count", Rcpp::wrap(pat.count));
+    
+    std::vector<int> positions;                                                 // within-context positions of packed matrix
+    for (auto it=pat.pat_map.begin(); it!=pat.pat_map.end(); it++) {
+      if (pack) {
+        positions.push_back(it->first);
+        continue;
+      }
+      Rcpp::IntegerVector column = Rcpp::wrap(it->second.bases);                // context factor for every column
+      column.attr("class") = "factor";
+      column.attr("levels") = contexts;
+      add_column(std::to_string(it->first), column);
+    }
+    T_pat_map().swap(pat.pat_map);                                              // and free it
+    
+    pat_df.attr("names") = pat_names;
+    pat_df.attr("row.names") = Rcpp::IntegerVector::create(NA_INTEGER, -(int)npat); // compact row names
+    pat_df.attr("class") = "data.frame";
+    
+    if (pack) {
+      Rcpp::RawVector packed (pat.packed.begin(), pat.packed.end());
+      std::vector<uint8_t>().swap(pat.packed);
+      res[t] = Rcpp::List::create(
+        Rcpp::Named("patterns") = pat_df,
+        Rcpp::Named("positions") = positions,
+        Rcpp::Named("packed") = packed
+      );
+    } else {
+      res[t] = pat_df;
+    }
   }
   
-  Rcpp::IntegerVector pat_rname(npat, (int)target_rname);                       // rname factor (size, value)
-  pat_rname.attr("class") = rname.attr("class");
-  pat_rname.attr("levels") = rname.attr("levels");
-  
-  res.push_front(pat_fnv, "pattern");
-  res.push_front(pat_beta, "beta");
-  res.push_front(pat_nbase, "nbase");
-  res.push_front(pat_end, "end");
-  res.push_front(pat_start, "start");
-  res.push_front(pat_strand, "strand");
-  res.push_front(pat_rname, "seqnames");
-  
-  Rcpp::IntegerVector col_strand = res["strand"];                               // strand factor
-  col_strand.attr("class") = strand.attr("class");
-  col_strand.attr("levels") = strand.attr("levels");
-  
-  return(res) ;
+  return res;
 }
 
 
@@ -215,11 +405,11 @@ Rcpp::DataFrame rcpp_extract_patterns(Rcpp::DataFrame &df,
 
 /*** R
 bam <- preprocessBam(bam.file=system.file("extdata", "amplicon010meth.bam", package="epialleleR"))
-z <- data.table::data.table(rcpp_extract_patterns(bam, 47, 43124861, 43125249, 1, "zZ", 0.1, TRUE, 0, as.integer(c())))
+z <- data.table::data.table(rcpp_extract_patterns(bam, 47, 43124861, 43125249, 1, "zZ", 0.1, TRUE, 0, list(integer(0)), FALSE, FALSE, 1)[[1]])
 z[, c(lapply(.SD, unique), .N), by=pattern, .SDcols=grep("^X", colnames(z), value=TRUE)][order(-N)]
 */
 
 // Sourcing:
-// Rcpp::sourceCpp("rcpp_cx_report.cpp")
+// Rcpp::sourceCpp("rcpp_extract_patterns.cpp")
 
 // #############################################################################
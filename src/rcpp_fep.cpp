@@ -1,37 +1,128 @@
 #include <Rcpp.h>
-#include <htslib/kfunc.h>
+#include <cmath>
+#include <unordered_map>
+#include "epialleleR.h"
 
-// [[Rcpp::depends(Rhtslib)]]
+// Computes Fisher Exact P for 2x2 tables, the same way as HTSlib's
+// kt_fisher_exact does: tables are walked from both tails towards the observed
+// one, and probabilities not greater than the probability of the observed
+// table are summed up.
+//
+// Batched: tables of several column sets (four columns each, e.g., for both
+// strands) are processed in one call. As many tables repeat exactly
+// (especially at low coverage), every unique table is evaluated only once.
+// Log-factorials are cached in a table sized to the largest total, and unique
+// tables are evaluated in parallel.
 
-// Computes Fisher Exact P using HTSlib's implementation
 
-// [[Rcpp::export]]
-std::vector<double> rcpp_fep (Rcpp::DataFrame &df,                              // data.table by reference with the following columns:
-                              std::vector<std::string> colnames)                // four strings with column names
-                              
+// 2x2 table: n11, n12, n21, n22
+typedef std::array<int,4> T_table;
+struct T_table_hash {
+  size_t operator()(const T_table &table) const {
+    uint64_t hash = FNV1a_OFFSET_BASIS;
+    const uint8_t *table_x = (const uint8_t*) table.data();
+    fnv_add(hash, table_x, sizeof(T_table));
+    return hash;
+  }
+};
+
+// Two-tailed P, given the table of log-factorials
+inline double fisher_exact_two(const T_table &table, const std::vector<double> &lf)
 {
-  Rcpp::IntegerVector A = df[colnames[0]];                                      // A
-  Rcpp::IntegerVector B = df[colnames[1]];                                      // B
-  Rcpp::IntegerVector C = df[colnames[2]];                                      // C
-  Rcpp::IntegerVector D = df[colnames[3]];                                      // D
+  const int n11 = table[0];
+  const int n1_ = table[0] + table[1];
+  const int n_1 = table[0] + table[2];
+  const int n = table[0] + table[1] + table[2] + table[3];
+  const int max = std::min(n_1, n1_);                                           // max n11, for right tail
+  const int min = std::max(0, n1_ + n_1 - n);                                   // min n11, for left tail
+  if (min==max) return 1.;                                                      // no need to do test
   
-  std::vector<double> p(A.size(), NA_REAL);
-  double left, right, two;
+  // hypergeometric probabilities relative to the one of the observed table,
+  // no underflow for unlikely tables
+  const double lconst = lf[n1_] + lf[n-n1_] + lf[n_1] + lf[n-n_1] - lf[n];
+  auto lprob = [&] (const int k) {
+    return lconst - lf[k] - lf[n1_-k] - lf[n_1-k] - lf[n-n1_-n_1+k];
+  };
+  const double lq = lprob(n11);
+  auto ratio = [&] (const int k) { return std::exp(lprob(k) - lq); };
+  
+  // left tail
+  int i;
+  double p = ratio(min), left = 0.;
+  for (i=min+1; p<0.99999999 && i<=max; ++i) {
+    left += p;
+    p = ratio(i);
+  }
+  if (p<1.00000001) left += p;
+  // right tail
+  int j;
+  double right = 0.;
+  p = ratio(max);
+  for (j=max-1; p<0.99999999 && j>=min; --j) {
+    right += p;
+    p = ratio(j);
+  }
+  if (p<1.00000001) right += p;
+  // two-tail
+  const double two = (left + right) * std::exp(lq);
+  return two>1. ? 1. : two;
+}
+
+
+// [[Rcpp::export]]
+Rcpp::List rcpp_fep (Rcpp::DataFrame &df,                                       // data.table by reference with the following columns:
+                     std::vector<std::string> colnames,                         // column names, four per set (n11, n12, n21, n22)
+                     const int nthreads)                                        // number of threads
+{
+  if (colnames.empty() || colnames.size() % 4)
+    Rcpp::stop("Number of column names must be a multiple of four");
+  const size_t nsets = colnames.size() / 4;
+  const size_t nrows = df.nrows();
   
-  for (unsigned int x=0; x<A.size(); x++) {
-    // checking for the interrupt
-    if ((x & 0xFFFFF) == 0) Rcpp::checkUserInterrupt();
-    
-    if (!Rcpp::IntegerVector::is_na(A[x]) &&
-        !Rcpp::IntegerVector::is_na(B[x]) &&
-        !Rcpp::IntegerVector::is_na(C[x]) &&
-        !Rcpp::IntegerVector::is_na(D[x])) {
-      kt_fisher_exact(A[x], B[x], C[x], D[x], &left, &right, &two);
-      p[x] = two;
+  // unique tables
+  std::unordered_map<T_table, int, T_table_hash> table_idx;
+  std::vector<T_table> tables;
+  std::vector<int> idx (nsets * nrows, -1);                                     // index of unique table for every row of every set, -1 for NA
+  int max_n = 0;                                                                // max total of unique tables
+  for (size_t s=0; s<nsets; s++) {
+    std::vector<Rcpp::NumericVector> cols;
+    for (size_t c=0; c<4; c++) cols.push_back(df[colnames[s*4 + c]]);
+    for (size_t x=0; x<nrows; x++) {
+      T_table table;
+      bool is_na = false;
+      for (size_t c=0; c<4 && !is_na; c++) {
+        is_na = Rcpp::NumericVector::is_na(cols[c][x]);
+        table[c] = is_na ? 0 : cols[c][x];
+      }
+      if (is_na) continue;
+      const auto inserted = table_idx.emplace(table, tables.size());
+      if (inserted.second) {
+        tables.push_back(table);
+        max_n = std::max(max_n, table[0] + table[1] + table[2] + table[3]);
+      }
+      idx[s*nrows + x] = inserted.first->second;
     }
   }
   
-  return p;
+  // log-factorials
+  std::vector<double> lf (max_n + 1);
+  for (int i=0; i<=max_n; i++) lf[i] = std::lgamma(i + 1.);
+  
+  // unique tables in parallel
+  const int ntables = tables.size();
+  std::vector<double> two (ntables);
+#pragma omp parallel for schedule(dynamic, 256) num_threads(nthreads)
+  for (int u=0; u<ntables; u++) two[u] = fisher_exact_two(tables[u], lf);
+  
+  Rcpp::List res (nsets);
+  for (size_t s=0; s<nsets; s++) {
+    Rcpp::NumericVector p (nrows, NA_REAL);
+    for (size_t x=0; x<nrows; x++)
+      if (idx[s*nrows + x]>=0) p[x] = two[idx[s*nrows + x]];
+    res[s] = p;
+  }
+  
+  return res;
 }
 
 
@@ -41,10 +132,10 @@ std::vector<double> rcpp_fep (Rcpp::DataFrame &df,
 /*** R
 d <- data.table::data.table(matrix(c(NA, 1:8095), ncol=4))
 n <- c("V1", "V2", "V3", "V4");
-system.time( p <- rcpp_fep(d, n) )
+system.time( p <- rcpp_fep(d, n, 1)[[1]] )
 system.time( f <- apply(d, 1, function (x) {if (any(is.na(x))) NA else stats::fisher.test(matrix(x, nrow=2))$p.value}) )
 max(abs(p-f), na.rm=TRUE)
-# microbenchmark::microbenchmark(rcpp_fep(d, n), times=10)
+# microbenchmark::microbenchmark(rcpp_fep(d, n, 1), times=10)
 */
 
 // Sourcing:
@@ -1,20 +1,141 @@
 #include <Rcpp.h>
+#include <cstdint>
+#include <tuple>
 #include <htslib/hts.h>
 #include "epialleleR.h"
 
 // Matches reads with given 1-base positions (VCF) and returns base frequencies.
-// FUNCTION ASSUMES THAT BOTH READS AND VCF ENTRIES ARE SORTED!
 // Return value: std::array<int,20> for each position in VCF
 // Array indices are 0123 for ACGT, and 4 for N and extended IUPAC,
 // thus they appear as following: U+*5, U-*5, M+*5, M-*5
+// OR (rcpp_get_allele_freqs) bisulfite-aware frequencies of REF and ALT alleles
+// for each position in VCF, resolved while counting (see T_allele_table)
+//
+// VCF positions are indexed per reference sequence, therefore every read
+// visits only the positions it covers (binary search for the first one),
+// and neither reads nor VCF entries have to be sorted. Reads are split into
+// contiguous chunks processed in parallel. Every chunk counts bases in its own
+// array that spans only the index range covered by the reads of this chunk
+// (i.e., small genomic window if reads are sorted), and these arrays are
+// merged at the end. If ranges of chunks overlap heavily (unsorted reads), all
+// chunks count in a single shared array instead, so memory stays bounded by
+// the size of VCF.
 
 
-// MATCH VCF ENTRIES, RETURN BASE FREQS
-// fast, vectorised
-// [[Rcpp::export("rcpp_get_base_freqs")]]
-Rcpp::NumericMatrix rcpp_get_base_freqs(Rcpp::DataFrame &df,                    // BAM data
-                                        std::vector<bool> pass,                 // read passes the threshold?
-                                        Rcpp::DataFrame &vcf)                   // VCF data
+// VCF positions sorted by reference sequence and position
+class T_vcf_index {
+public:
+  std::vector<int> pos;                                                         // sorted positions
+  std::vector<int> row;                                                         // 0-based VCF rows of these positions
+  std::vector<size_t> offset;                                                   // positions of rname c are [offset[c], offset[c+1])
+  
+  T_vcf_index(Rcpp::DataFrame &vcf) {
+    Rcpp::IntegerVector vcf_chr = vcf["seqnames"];                              // VCF rname
+    Rcpp::IntegerVector vcf_pos = vcf["start"];                                 // VCF start
+    
+    int nchr = 0;
+    for (int i=0; i<vcf_chr.size(); i++)
+      if (vcf_chr[i]!=NA_INTEGER && vcf_chr[i]>nchr) nchr = vcf_chr[i];
+    std::vector<std::tuple<int,int,int>> entries;
+    entries.reserve(vcf_chr.size());
+    for (int i=0; i<vcf_chr.size(); i++) {
+      if (vcf_chr[i]==NA_INTEGER || vcf_chr[i]<0) continue;                     // rname is not in BAM
+      entries.emplace_back(vcf_chr[i], vcf_pos[i], i);
+    }
+    std::sort(entries.begin(), entries.end());
+    
+    offset.assign(nchr+2, 0);
+    pos.resize(entries.size());
+    row.resize(entries.size());
+    for (size_t k=0; k<entries.size(); k++) {
+      offset[std::get<0>(entries[k])+1]++;
+      pos[k] = std::get<1>(entries[k]);
+      row[k] = std::get<2>(entries[k]);
+    }
+    for (int c=0; c<=nchr; c++) offset[c+1] += offset[c];
+  }
+  
+  // index range [first, last) of positions within [start, end] of rname chr
+  void range(const int chr, const int start, const int end, size_t &first, size_t &last) const {
+    first = last = 0;
+    if (chr==NA_INTEGER || chr<0 || (size_t)chr+1>=offset.size()) return;       // no positions on this rname
+    const std::vector<int>::const_iterator from = pos.begin() + offset[chr];
+    const std::vector<int>::const_iterator to = pos.begin() + offset[chr+1];
+    first = std::lower_bound(from, to, start) - pos.begin();
+    last = std::upper_bound(pos.begin()+first, to, end) - pos.begin();
+  }
+};
+
+
+// Bisulfite-aware resolution of REF and ALT alleles of SNVs.
+// Unmethylated C reads as T on "+" strand, and G reads as A on "-" strand,
+// therefore every base of an allele is extended to a set of bases:
+//   "+": A={A}, C={C,T}, G={G}, T={T}
+//   "-": A={A}, C={C},   G={G,A}, T={T}
+// Read base is counted as REF or ALT if it belongs to the set of REF or ALT
+// bases. If sets overlap (C>T and T>C on "+", G>A and A>G on "-"), alleles
+// can't be distinguished on this strand and its counts are NA. Only REF and
+// ALT among ACGT (index 0-3) and REF!=ALT are resolved, everything else is NA.
+// Indices of bases are the ones of seq_nt16_int: 0123 for ACGT, 4 for N etc.
+enum T_allele : uint8_t { ALLELE_REF=0, ALLELE_ALT=1, ALLELE_NONE=2, ALLELE_NA=3 };
+
+constexpr bool in_allele(const int base, const int allele, const int strand)
+{
+  return base==allele ||
+    (strand==0 && allele==1 && base==3) ||                                      // C>T on "+"
+    (strand==1 && allele==2 && base==0);                                        // G>A on "-"
+}
+
+constexpr uint8_t resolve_allele(const int ref, const int alt, const int strand, const int base)
+{
+  if (ref>3 || alt>3 || ref==alt) return ALLELE_NA;
+  if (in_allele(alt, ref, strand) || in_allele(ref, alt, strand)) return ALLELE_NA;
+  if (in_allele(base, ref, strand)) return ALLELE_REF;
+  if (in_allele(base, alt, strand)) return ALLELE_ALT;
+  return ALLELE_NONE;
+}
+
+// Lookup table of alleles by [ref][alt][strand][base], strand 0 for "+"
+typedef std::array<uint8_t, 5*5*2*5> T_allele_table;
+constexpr T_allele_table make_allele_table()
+{
+  T_allele_table table {};
+  for (int ref=0; ref<5; ref++)
+    for (int alt=0; alt<5; alt++)
+      for (int strand=0; strand<2; strand++)
+        for (int base=0; base<5; base++)
+          table[((ref*5 + alt)*2 + strand)*5 + base] = resolve_allele(ref, alt, strand, base);
+  return table;
+}
+constexpr T_allele_table allele_table = make_allele_table();
+#define allele_lookup(pair, strand, base) allele_table[(((pair)*2 + (strand))*5 + (base))]
+
+// Index of REF/ALT pair, [0;24]
+inline uint8_t allele_pair(const std::string &ref, const std::string &alt)
+{
+  auto to_idx = [] (const std::string &a) {
+    return a.size()==1 ? seq_nt16_int[seq_nt16_table[(unsigned char)a[0]]] : 4;
+  };
+  return to_idx(ref)*5 + to_idx(alt);
+}
+
+
+// Counts bases of reads at VCF positions. Reads are split into contiguous
+// chunks processed in parallel. Every chunk counts bases in its own array that
+// spans only the index range covered by the reads of this chunk (i.e., small
+// genomic window if reads are sorted), and these arrays are merged at the end.
+// When the sum of chunk ranges exceeds twice their union, one array spanning
+// the union is shared by all chunks and updated atomically.
+// column(k, strand, pass, base) returns the column to count a base at index
+// position k in, or -1 if base is not counted.
+// Output: std::vector with ncols counts for every VCF row
+template <int ncols, class F>
+std::vector<unsigned int> count_bases(Rcpp::DataFrame &df,                      // BAM data
+                                      Rcpp::LogicalVector &pass,                // read passes the threshold?
+                                      const T_vcf_index &index,                 // VCF index
+                                      const size_t nrows,                       // number of VCF rows
+                                      F column,                                 // column to count a base in
+                                      const int nthreads)                       // number of threads
 {
   Rcpp::IntegerVector read_rname = df["rname"];                                 // template rname
   Rcpp::IntegerVector read_strand = df["strand"];                               // template strand
@@ -22,50 +143,182 @@ Rcpp::NumericMatrix rcpp_get_base_freqs(Rcpp::DataFrame &df,
   Rcpp::XPtr<std::vector<std::string>> seqxm((SEXP)df.attr("seqxm_xptr"));      // merged refspaced packed template SEQXMs, as a pointer to std::vector<std::string>
   Rcpp::IntegerVector templid = df["templid"];                                  // template id, effectively holds indexes of corresponding std::string in std::vector
   
-  Rcpp::IntegerVector vcf_chr = vcf["seqnames"];                                // VCF rname
-  Rcpp::IntegerVector vcf_pos = vcf["start"];                                   // VCF start
+  // raw pointers: no Rcpp API calls within threads
+  const int nreads = read_start.size();
+  const int *read_rname_x = read_rname.begin();
+  const int *read_strand_x = read_strand.begin();
+  const int *read_start_x = read_start.begin();
+  const int *templid_x = templid.begin();
+  const int *pass_x = pass.begin();
+  const std::vector<std::string> &seqxm_x = *seqxm;
+  
+  const int nchunks = std::max(1, nthreads);
+  std::vector<size_t> chunk_first (nchunks, SIZE_MAX);                          // first index position covered by a chunk
+  std::vector<size_t> chunk_last (nchunks, 0);                                  // last index position covered by a chunk, exclusive
+  std::vector<std::vector<unsigned int>> chunk_freqs (nchunks);                 // base counts, ncols per index position
+  
+  // index range covered by reads of every chunk
+#pragma omp parallel for schedule(static) num_threads(nthreads)
+  for (int t=0; t<nchunks; t++) {
+    const int from = (long long)nreads * t / nchunks;
+    const int to = (long long)nreads * (t+1) / nchunks;
+    for (int x=from; x<to; x++) {
+      size_t first, last;
+      index.range(read_rname_x[x], read_start_x[x], read_start_x[x] + seqxm_x[templid_x[x]].size() - 1, first, last);
+      if (first==last) continue;
+      chunk_first[t] = std::min(chunk_first[t], first);
+      chunk_last[t] = std::max(chunk_last[t], last);
+    }
+  }
   
-  Rcpp::NumericMatrix res(vcf_pos.size(),20);
+  // own arrays for every chunk, or a single shared one if they overlap heavily
+  size_t union_first = SIZE_MAX, union_last = 0, sum_span = 0;
+  for (int t=0; t<nchunks; t++) {
+    if (chunk_first[t]>=chunk_last[t]) continue;                                // no matches in this chunk
+    union_first = std::min(union_first, chunk_first[t]);
+    union_last = std::max(union_last, chunk_last[t]);
+    sum_span += chunk_last[t] - chunk_first[t];
+  }
+  if (union_first>=union_last) return std::vector<unsigned int> (nrows * ncols, 0); // no matches at all
+  const bool shared = nchunks>1 && sum_span > 2*(union_last - union_first);
+  if (shared) {
+    chunk_freqs[0].assign((union_last - union_first) * ncols, 0);
+    chunk_first[0] = union_first;
+  } else {
+    for (int t=0; t<nchunks; t++)
+      if (chunk_first[t]<chunk_last[t]) chunk_freqs[t].assign((chunk_last[t] - chunk_first[t]) * ncols, 0);
+  }
   
-  int cur_vcf=0;
-  for (unsigned int x=0; x<read_start.size(); x++) {
-    // checking for the interrupt
-    if ((x & 0xFFFFF) == 0) Rcpp::checkUserInterrupt();
+#pragma omp parallel for schedule(static) num_threads(nthreads)
+  for (int t=0; t<nchunks; t++) {
+    const int from = (long long)nreads * t / nchunks;
+    const int to = (long long)nreads * (t+1) / nchunks;
+    const int c = shared ? 0 : t;                                               // chunk to count in
+    if (chunk_freqs[c].empty()) continue;                                       // no matches in this chunk
+    unsigned int *freqs = chunk_freqs[c].data();
+    const size_t chunk_lo = chunk_first[c];
     
-    const int read_rname_x = read_rname[x];
-    const int read_start_x = read_start[x];
-    const int read_end_x = read_start_x + seqxm->at(templid[x]).size() - 1;
-    for (unsigned int i=cur_vcf; i<vcf_pos.size(); i++) {
-      const int vcf_chr_i = vcf_chr[i];
-      const int vcf_pos_i = vcf_pos[i];
-      if (vcf_chr_i<read_rname_x || 
-          (vcf_chr_i==read_rname_x && vcf_pos_i<read_start_x)) {                // skip VCF if before read
-        cur_vcf=i;
-        continue;
-      }
-      if (vcf_chr_i>read_rname_x ||
-          (vcf_chr_i==read_rname_x && vcf_pos_i>read_end_x)) {                  // start over from cur_vcf for new read
-        break;
-      }
-      if (vcf_chr_i==read_rname_x &&
-          vcf_pos_i>=read_start_x && vcf_pos_i<=read_end_x) {                   // match found
-        int idx = seq_nt16_int[unpack_seq_idx(seqxm->at(templid[x])[vcf_pos_i-read_start_x])]; // index of a base, [0;4]
-        idx += (read_strand[x]-1) * 5;                                          // shift by 5 if '-' strand (==2)
-        idx += ((bool)(pass[x])) * 10;                                          // shift by 10 if pass==TRUE (==1)
-        res(i,idx)++;
+    for (int x=from; x<to; x++) {
+      const std::string &seqxm_t = seqxm_x[templid_x[x]];
+      size_t first, last;
+      index.range(read_rname_x[x], read_start_x[x], read_start_x[x] + seqxm_t.size() - 1, first, last);
+      const int strand = read_strand_x[x]-1;                                    // 0 for '+', 1 for '-'
+      const bool passed = pass_x[x]==TRUE;
+      for (size_t k=first; k<last; k++) {                                       // match found
+        const int base = seq_nt16_int[unpack_seq_idx(seqxm_t[index.pos[k]-read_start_x[x]])]; // index of a base, [0;4]
+        const int col = column(k, strand, passed, base);
+        if (col<0) continue;
+        unsigned int &freq = freqs[(k - chunk_lo) * ncols + col];
+        if (shared) {
+#pragma omp atomic
+          freq++;
+        } else {
+          freq++;
+        }
       }
     }
   }
+  
+  std::vector<unsigned int> res (nrows * ncols, 0);
+  for (int t=0; t<nchunks; t++) {
+    const std::vector<unsigned int> &freqs = chunk_freqs[t];
+    for (size_t k=0; k<freqs.size()/ncols; k++) {
+      const size_t row = index.row[chunk_first[t] + k];
+      for (int col=0; col<ncols; col++) res[row*ncols + col] += freqs[k*ncols + col];
+    }
+  }
+  
+  return res;
+}
+
+
+// MATCH VCF ENTRIES, RETURN BASE FREQS
+// fast, vectorised
+// [[Rcpp::export("rcpp_get_base_freqs")]]
+Rcpp::NumericMatrix rcpp_get_base_freqs(Rcpp::DataFrame &df,                    // BAM data
+                                        Rcpp::LogicalVector &pass,              // read passes the threshold?
+                                        Rcpp::DataFrame &vcf,                   // VCF data
+                                        const int nthreads)                     // number of threads
+{
+  const T_vcf_index index (vcf);
+  const size_t nrows = vcf.nrows();
+  const std::vector<unsigned int> freqs = count_bases<20>(
+    df, pass, index, nrows,
+    [] (const size_t k, const int strand, const bool passed, const int base) {
+      return strand*5 + passed*10 + base;                                       // shift by 5 if '-' strand, by 10 if pass==TRUE
+    },
+    nthreads
+  );
+  
+  Rcpp::NumericMatrix res(nrows,20);
+  for (size_t row=0; row<nrows; row++)
+    for (int col=0; col<20; col++) res(row,col) = freqs[row*20 + col];
 
   return res;
 }
 
 
+// MATCH VCF ENTRIES, RETURN ALLELE FREQS
+// fast, vectorised
+// Output: list with M+Ref, U+Ref, M-Ref, U-Ref, M+Alt, U+Alt, M-Alt, U-Alt,
+// SumRef and SumAlt columns (sums are of non-NA values)
+// [[Rcpp::export("rcpp_get_allele_freqs")]]
+Rcpp::List rcpp_get_allele_freqs(Rcpp::DataFrame &df,                           // BAM data
+                                 Rcpp::LogicalVector &pass,                     // read passes the threshold?
+                                 Rcpp::DataFrame &vcf,                          // VCF data
+                                 std::vector<std::string> ref,                  // REF alleles
+                                 std::vector<std::string> alt,                  // ALT alleles
+                                 const int nthreads)                            // number of threads
+{
+  const T_vcf_index index (vcf);
+  const size_t nrows = vcf.nrows();
+  if (ref.size()!=nrows || alt.size()!=nrows)
+    Rcpp::stop("REF and ALT must be of the same length as VCF");
+  std::vector<uint8_t> pair (nrows);                                            // REF/ALT pair per VCF row
+  for (size_t row=0; row<nrows; row++) pair[row] = allele_pair(ref[row], alt[row]);
+  
+  // column = allele*4 + strand*2 + !pass, i.e., M+Ref, U+Ref, M-Ref, U-Ref,
+  // M+Alt, U+Alt, M-Alt, U-Alt
+  const std::vector<unsigned int> freqs = count_bases<8>(
+    df, pass, index, nrows,
+    [&pair, &index] (const size_t k, const int strand, const bool passed, const int base) {
+      const uint8_t allele = allele_lookup(pair[index.row[k]], strand, base);
+      return allele>ALLELE_ALT ? -1 : allele*4 + strand*2 + !passed;
+    },
+    nthreads
+  );
+  
+  std::vector<Rcpp::NumericVector> cols;
+  for (int col=0; col<8; col++) cols.push_back(Rcpp::NumericVector(nrows));
+  Rcpp::NumericVector sum_ref (nrows), sum_alt (nrows);
+  for (size_t row=0; row<nrows; row++) {
+    for (int strand=0; strand<2; strand++) {
+      const bool is_na = allele_lookup(pair[row], strand, 0)==ALLELE_NA;       // alleles can't be distinguished on this strand
+      for (int allele=0; allele<2; allele++) {
+        for (int notpass=0; notpass<2; notpass++) {
+          const int col = allele*4 + strand*2 + notpass;
+          cols[col][row] = is_na ? NA_REAL : freqs[row*8 + col];
+          if (!is_na) (allele==ALLELE_REF ? sum_ref : sum_alt)[row] += freqs[row*8 + col];
+        }
+      }
+    }
+  }
+  
+  return Rcpp::List::create(
+    Rcpp::Named("M+Ref") = cols[0], Rcpp::Named("U+Ref") = cols[1],
+    Rcpp::Named("M-Ref") = cols[2], Rcpp::Named("U-Ref") = cols[3],
+    Rcpp::Named("M+Alt") = cols[4], Rcpp::Named("U+Alt") = cols[5],
+    Rcpp::Named("M-Alt") = cols[6], Rcpp::Named("U-Alt") = cols[7],
+    Rcpp::Named("SumRef") = sum_ref, Rcpp::Named("SumAlt") = sum_alt
+  );
+}
+
+
 // test code in R
 //
 
 /*** R
-# microbenchmark::microbenchmark(rcpp_get_base_freqs(bam, pass, vcf.dt), times=10)
+# microbenchmark::microbenchmark(rcpp_get_base_freqs(bam, pass, vcf.dt, 1), times=10)
 */
 
 // Sourcing:
@@ -9,22 +9,20 @@
 // [[Rcpp::export("rcpp_get_xm_beta")]]
 std::vector<double> rcpp_get_xm_beta(Rcpp::DataFrame &df,                       // BAM data
                                      const std::string ctx_meth,                // methylated context string, e.g. "XZ". NON-EMPTY
-                                     const std::string ctx_unmeth)              // unmethylated context string, e.g. "xz". NON-EMPTY
+                                     const std::string ctx_unmeth,              // unmethylated context string, e.g. "xz". NON-EMPTY
+                                     const int nthreads)                        // number of threads
 {
   Rcpp::XPtr<std::vector<std::string>> seqxm((SEXP)df.attr("seqxm_xptr"));      // merged refspaced packed template SEQXMs, as a pointer to std::vector<std::string>
   Rcpp::IntegerVector templid = df["templid"];                                  // template id, effectively holds indexes of corresponding std::string in std::vector
+  const ctx_hist_view ctxhist(df, *seqxm, nthreads);                            // per-template context histograms
   
-  std::vector<double> res (seqxm->size(), 0);
-  for (unsigned int x=0; x<seqxm->size(); x++) {
-    // checking for the interrupt
-    if ((x & 0xFFFFF) == 0) Rcpp::checkUserInterrupt();
-    
-    unsigned int ctx_map[16] = {0};
-    const char* seqxm_x = seqxm->at(templid[x]).c_str();                        // seqxm->at(templid[x]) is a reference to a corresponding SEQXM string
-    const unsigned int size_x = seqxm->at(templid[x]).size();                   // length of the current read
-    for (unsigned int i=0; i<size_x; i++) {                                     // char by char - it's faster this way than using std::string in the cycle
-      ctx_map[unpack_ctx_idx(seqxm_x[i])]++;                                    // extract lower 4 bits (XM) and count them;
-    }
+  const int nreads = templid.size();                                            // one result per read, the data can be a subset
+  std::vector<double> res (nreads, 0);
+  const int *templid_x = templid.begin();                                       // raw pointer: no Rcpp API calls within threads
+  
+#pragma omp parallel for schedule(static) num_threads(nthreads)
+  for (int x=0; x<nreads; x++) {
+    const T_ctx_hist &ctx_map = ctxhist[templid_x[x]];                            // counts of context indices, no need to scan SEQXM
     
     unsigned int n_ctx_meth = 0;
     std::for_each(ctx_meth.begin(), ctx_meth.end(), [&n_ctx_meth, &ctx_map] (unsigned int const &c) {
@@ -43,13 +41,140 @@ std::vector<double> rcpp_get_xm_beta(Rcpp::DataFrame &df,
 }
 
 
+// Per-region data for eCDFs of within- and out-of-context per-read beta values.
+// Beta values are computed and grouped by BED region in a single pass over the
+// pairs of read and region indices (a read can match several regions), then
+// sorted and run-length encoded within every region: unique values
+// (knots) and their counts are all that is needed to construct the same
+// step functions as stats::ecdf does.
+// Output: list of two (context and out-of-context) lists, each with 0-based
+// offsets of regions (length(rows)+1), unique beta values and their counts
+// [[Rcpp::export("rcpp_get_bed_ecdf")]]
+Rcpp::List rcpp_get_bed_ecdf(Rcpp::DataFrame &df,                               // BAM data
+                             Rcpp::IntegerVector &read,                         // 1-based read index
+                             Rcpp::IntegerVector &bedmatch,                     // 1-based region index or NA for every read index
+                             Rcpp::IntegerVector &rows,                         // regions to report, 1-based index or NA for unmatched reads
+                             const std::string ctx_meth,                        // methylated context string, e.g. "XZ". NON-EMPTY
+                             const std::string ctx_unmeth,                      // unmethylated context string, e.g. "xz". NON-EMPTY
+                             const std::string ooctx_meth,                      // methylated out-of-context string, e.g. "HU"
+                             const std::string ooctx_unmeth,                    // unmethylated out-of-context string, e.g. "hu"
+                             const int nthreads)                                // number of threads
+{
+  Rcpp::XPtr<std::vector<std::string>> seqxm((SEXP)df.attr("seqxm_xptr"));      // merged refspaced packed template SEQXMs, as a pointer to std::vector<std::string>
+  Rcpp::IntegerVector templid = df["templid"];                                  // template id, effectively holds indexes of corresponding std::string in std::vector
+  const ctx_hist_view ctxhist(df, *seqxm, nthreads);                            // per-template context histograms
+  
+  const int npairs = bedmatch.size();
+  const int nrows = rows.size();
+  
+  // region index (0 for unmatched reads) to output slot
+  int max_row = 0;
+  for (int i=0; i<nrows; i++)
+    if (rows[i]!=NA_INTEGER && rows[i]>max_row) max_row = rows[i];
+  std::vector<int> slot (max_row+1, -1);
+  for (int i=0; i<nrows; i++)
+    if (rows[i]==NA_INTEGER || rows[i]>0) slot[rows[i]==NA_INTEGER ? 0 : rows[i]] = i;
+  
+  // counting sort of pairs by slot: destination of every pair
+  std::vector<size_t> offset (nrows+1, 0);
+  std::vector<int> pair_slot (npairs, -1);
+  for (int p=0; p<npairs; p++) {
+    const int r = bedmatch[p]==NA_INTEGER ? 0 : bedmatch[p];
+    if (r<0 || r>max_row || slot[r]<0) continue;                                // region was not requested
+    pair_slot[p] = slot[r];
+    offset[slot[r]+1]++;
+  }
+  for (int i=0; i<nrows; i++) offset[i+1] += offset[i];
+  std::vector<size_t> dest (npairs, 0);
+  std::vector<size_t> pos (offset.begin(), offset.end()-1);
+  for (int p=0; p<npairs; p++)
+    if (pair_slot[p]>=0) dest[p] = pos[pair_slot[p]]++;
+  
+  // strings to context indices
+  auto to_idx = [] (const std::string &str) {
+    std::vector<unsigned int> idx;
+    for (const char &c : str) idx.push_back(ctx_to_idx(c));
+    return idx;
+  };
+  const std::vector<unsigned int> ctx_meth_idx = to_idx(ctx_meth), ctx_unmeth_idx = to_idx(ctx_unmeth);
+  const std::vector<unsigned int> ooctx_meth_idx = to_idx(ooctx_meth), ooctx_unmeth_idx = to_idx(ooctx_unmeth);
+  // the same as rcpp_get_xm_beta above
+  auto get_beta = [] (const T_ctx_hist &ctx_map, const std::vector<unsigned int> &meth_idx,
+                      const std::vector<unsigned int> &unmeth_idx) {
+    unsigned int n_meth = 0, n_unmeth = 0;
+    for (const unsigned int &i : meth_idx) n_meth += ctx_map[i];
+    for (const unsigned int &i : unmeth_idx) n_unmeth += ctx_map[i];
+    unsigned int n_all = n_meth + n_unmeth;
+    if (n_all==0) n_all=1;
+    return (double)n_meth / n_all;
+  };
+  
+  // beta values, grouped by slot
+  std::vector<double> ctx_beta (offset[nrows]), ooctx_beta (offset[nrows]);
+  const int *templid_x = templid.begin();                                       // raw pointers: no Rcpp API calls within threads
+  const int *read_x = read.begin();
+#pragma omp parallel for schedule(static) num_threads(nthreads)
+  for (int p=0; p<npairs; p++) {
+    if (pair_slot[p]<0) continue;
+    const T_ctx_hist &ctx_map = ctxhist[templid_x[read_x[p]-1]];
+    ctx_beta[dest[p]] = get_beta(ctx_map, ctx_meth_idx, ctx_unmeth_idx);
+    ooctx_beta[dest[p]] = get_beta(ctx_map, ooctx_meth_idx, ooctx_unmeth_idx);
+  }
+  
+  // sorting and run-length encoding (in place) within slots
+  std::vector<int> ctx_count (offset[nrows]), ooctx_count (offset[nrows]);
+  std::vector<size_t> ctx_nuniq (nrows, 0), ooctx_nuniq (nrows, 0);
+  auto rle = [] (double *values, int *counts, const size_t size) {
+    std::sort(values, values+size);
+    size_t n = 0;
+    for (size_t i=0; i<size; i++) {
+      if (n>0 && values[n-1]==values[i]) {
+        counts[n-1]++;
+      } else {
+        values[n] = values[i];
+        counts[n++] = 1;
+      }
+    }
+    return n;
+  };
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+  for (int i=0; i<nrows; i++) {
+    const size_t size = offset[i+1] - offset[i];
+    ctx_nuniq[i] = rle(ctx_beta.data()+offset[i], ctx_count.data()+offset[i], size);
+    ooctx_nuniq[i] = rle(ooctx_beta.data()+offset[i], ooctx_count.data()+offset[i], size);
+  }
+  
+  // compact output
+  auto wrap = [&nrows, &offset] (const std::vector<double> &beta, const std::vector<int> &count,
+                                 const std::vector<size_t> &nuniq) {
+    Rcpp::IntegerVector res_offset (nrows+1);
+    for (int i=0; i<nrows; i++) res_offset[i+1] = res_offset[i] + nuniq[i];
+    Rcpp::NumericVector res_value (res_offset[nrows]);
+    Rcpp::IntegerVector res_count (res_offset[nrows]);
+    for (int i=0; i<nrows; i++) {
+      std::copy(beta.begin()+offset[i], beta.begin()+offset[i]+nuniq[i], res_value.begin()+res_offset[i]);
+      std::copy(count.begin()+offset[i], count.begin()+offset[i]+nuniq[i], res_count.begin()+res_offset[i]);
+    }
+    return Rcpp::List::create(
+      Rcpp::Named("offset") = res_offset,                                       // 0-based offsets of regions
+      Rcpp::Named("value") = res_value,                                         // unique beta values, sorted within regions
+      Rcpp::Named("count") = res_count                                          // number of reads with such beta value
+    );
+  };
+  
+  return Rcpp::List::create(
+    Rcpp::Named("context") = wrap(ctx_beta, ctx_count, ctx_nuniq),
+    Rcpp::Named("out.of.context") = wrap(ooctx_beta, ooctx_count, ooctx_nuniq)
+  );
+}
+
 // test code in R
 //
 
 /*** R
 # ctx.meth   <- "ZX"
 # ctx.unmeth <- "zx"
-# microbenchmark::microbenchmark(rcpp_get_xm_beta(bam, ctx.meth, ctx.unmeth), times=10)
+# microbenchmark::microbenchmark(rcpp_get_xm_beta(bam, ctx.meth, ctx.unmeth, 1), times=10)
 */
 
 // Sourcing:
@@ -0,0 +1,441 @@
+#include <Rcpp.h>
+#include <array>
+#include <climits>
+#include <cmath>
+#include <boost/container/flat_map.hpp>
+#include "epialleleR.h"
+
+// [[Rcpp::plugins(cpp17)]]
+// [[Rcpp::depends(BH)]]
+
+// Methylation heterogeneity reports
+// PRE-SORTED DATASET IS A REQUIREMENT.
+// 
+// Computes read-level methylation heterogeneity metrics in a single pass:
+// - proportion of discordant reads (PDR, Landau et al., 2014): fraction of
+//   reads (read pairs) having at least min_length within-context bases that
+//   are neither fully methylated nor fully unmethylated
+// - epipolymorphism (Landan et al., 2012): 1 - sum(p^2), where p are the
+//   frequencies of 16 possible methylation patterns of windows, i.e., of
+//   successive stretches of 4 within-context bases
+// - methylation entropy (Xie et al., 2011): -1/4 * sum(p * log2(p)) for the
+//   same windows
+// Windows are made of successive within-context bases of every read (read
+// pair) and are attributed to the position of their first base. Reads are
+// filtered by max_ooctx_meth_frac as in lMHL report.
+// 
+// ctx_to_idx conversion is described in epialleleR.h file
+// 
+
+#define HET_WINDOW 4                                                            // number of within-context bases in a window
+#define HET_NPAT (1 << HET_WINDOW)                                              // number of possible window patterns
+
+// within-context bases of the read from..to (inclusive): offsets shifted by
+// one bit to the left, with methylation status in the lowest bit
+inline void get_haplotype(const char *seqxm_x, const int from, const int to,
+                          const unsigned int *ctx_map, std::vector<unsigned int> &hap)
+{
+  hap.clear();
+  for (int i=from; i<=to; i++) {
+    const unsigned int base_idx = unpack_ctx_idx(seqxm_x[i]);                   // index of current base context; see the table in epialleleR.h
+    if (ctx_map[base_idx]) hap.push_back(((unsigned int)i << 1) | (base_idx<8));// uppercase is methylated
+  }
+}
+
+// methylation pattern of the window starting at k-th base of the haplotype
+inline unsigned int get_window_pattern(const std::vector<unsigned int> &hap, const size_t k)
+{
+  unsigned int pattern = 0;
+  for (unsigned int j=0; j<HET_WINDOW; j++) pattern |= (hap[k+j] & 1) << j;
+  return pattern;
+}
+
+// is the haplotype neither fully methylated nor fully unmethylated
+inline bool is_discordant(const std::vector<unsigned int> &hap)
+{
+  size_t nmeth = 0;
+  for (const unsigned int &h : hap) nmeth += h & 1;
+  return nmeth>0 && nmeth<hap.size();
+}
+
+// number of reads, epipolymorphism and entropy of a window, given the counts
+// of its patterns
+inline void get_window_stats(const uint32_t *pat, uint64_t &nreads,
+                             double &epipoly, double &entropy)
+{
+  nreads = 0;
+  for (unsigned int p=0; p<HET_NPAT; p++) nreads += pat[p];
+  double sum_sq = 0, sum_log = 0;
+  for (unsigned int p=0; p<HET_NPAT && nreads; p++) {
+    if (!pat[p]) continue;
+    const double freq = (double)pat[p] / nreads;
+    sum_sq += freq * freq;
+    sum_log -= freq * std::log2(freq);
+  }
+  epipoly = 1 - sum_sq;
+  entropy = sum_log / HET_WINDOW;
+}
+
+
+// Per-cytosine report is prepared the same way as lMHL report.
+// Output report is a data.frame with nine columns and rows for every cytosine:
+// rname (factor), strand (factor), pos, ctx (factor), coverage, pdr, windows,
+// epipolymorphism, entropy
+// 
+// 1) all XM positions counted in uint32_t[16]: index is equal to char+2>>2&00001111
+// 2) for within-context bases, PDR counters and window patterns are counted too
+// 3) when gap in reads or another chr - spit map to res, clear map
+// 4) spit if within context and same context in more than 50% of the reads
+// 5) reads are split into partitions at reference changes or gaps, partitions
+//    are processed in parallel (OpenMP) and results are concatenated in order
+// 
+
+// [[Rcpp::export]]
+Rcpp::DataFrame rcpp_heterogeneity_report(Rcpp::DataFrame &df,                  // data frame with BAM data
+                                          const std::string ctx,                // context string for bases to report
+                                          const int min_length,                 // min number of within-context bases for a read to be included in PDR
+                                          const double max_ooctx_meth_frac,     // maximum fraction of methylated to total out-of-context bases (max out-of-context beta value)
+                                          const int nthreads)                   // number of OpenMP threads
+{
+  // walking trough bunch of reads <- filling the map
+  // pos -> {  0-31: per-strand context counters and coverage (9, 25) as in lMHL report,
+  //          32-49: F strand PDR reads (32), discordant reads (33), counts of window patterns (34-49),
+  //          50-67: the same for R strand }
+  
+  Rcpp::IntegerVector rname   = df["rname"];                                    // template rname
+  Rcpp::IntegerVector strand  = df["strand"];                                   // template strand
+  Rcpp::IntegerVector start   = df["start"];                                    // template start
+  Rcpp::IntegerVector templid = df["templid"];                                  // template id, effectively holds indexes of corresponding std::string in std::vector
+  
+  Rcpp::XPtr<std::vector<std::string>> seqxm((SEXP)df.attr("seqxm_xptr"));      // merged refspaced packed template SEQXMs, as a pointer to std::vector<std::string>
+  
+  // raw pointers to be used within threads
+  const int *rname_ptr = rname.begin(), *strand_ptr = strand.begin(), *start_ptr = start.begin(), *templid_ptr = templid.begin();
+  const std::vector<std::string> *seqxm_ptr = seqxm.get();
+  const ctx_hist_view ctxhist(df, *seqxm, nthreads);                            // per-template context histograms
+  
+  // main typedefs
+  typedef uint64_t T_key;                                                       // {64bit:pos}
+  typedef std::array<uint32_t, 32 + 2*(2+HET_NPAT)> T_val;                      // {9,25:coverage, 10 more for 11 valid chars * two strands, then PDR and window counters}
+  typedef boost::container::flat_map<T_key, T_val> T_het_map;                   // attaboy
+#define het_shft(s) (32 + (s)*(2+HET_NPAT))                                     // PDR and window counters of strand s (0 for F and 1 for R)
+
+  // partial results, one per partition of reads
+  struct T_res {
+    std::vector<int> rname, strand, pos, ctx, cov, nwin;
+    std::vector<double> pdr, epipoly, entropy;
+  };
+
+// macros
+#define spit_results {                                                                                                        \
+  for (T_het_map::iterator it=het_map.begin(); it!=het_map.end(); it++) {                                                     \
+    for (int s=0; s<2; s++) {                                                                      /* iterate over strands */ \
+      const unsigned int str_shft = s<<4;                                            /* strand shift: 0 for F and 16 for R */ \
+      const unsigned int max_freq_idx = get_major_ctx_idx(it->second, str_shft);          /* context in >50% of reads or 0 */ \
+      if (!ctx_map[max_freq_idx]) continue;                                                           /* if not within ctx */ \
+      const uint32_t *het = it->second.data() + het_shft(s);                                    /* PDR and window counters */ \
+      uint64_t nwin;                                                                                                          \
+      double epipoly, entropy;                                                                                                \
+      get_window_stats(het+2, nwin, epipoly, entropy);                                                                        \
+      res.strand.push_back(s+1);                                                                                 /* strand */ \
+      res.pos.push_back(it->first);                                                                                 /* pos */ \
+      res.ctx.push_back(max_freq_idx);                                                                          /* context */ \
+      res.cov.push_back(it->second[max_freq_idx+str_shft] + it->second[(max_freq_idx+str_shft) | 8]);     /* meth + unmeth */ \
+      res.pdr.push_back(het[0] ? (double)het[1]/het[0] : NA_REAL);                                                  /* PDR */ \
+      res.nwin.push_back(nwin);                                                                      /* reads with windows */ \
+      res.epipoly.push_back(nwin ? epipoly : NA_REAL);                                                  /* epipolymorphism */ \
+      res.entropy.push_back(nwin ? entropy : NA_REAL);                                                          /* entropy */ \
+    }                                                                                                                         \
+  }                                                                                                                           \
+  res.rname.resize(res.strand.size(), cur_rname);                                                           /* same rname! */ \
+  max_pos=0;                                                                                                                  \
+  het_map.clear();                                                                                                            \
+  hint = het_map.end();                                                                                                       \
+};
+
+  // array of contexts to print
+  unsigned int ctx_map [16] = {0};
+  std::for_each(ctx.begin(), ctx.end(), [&ctx_map] (unsigned int const &c) {
+    ctx_map[ctx_to_idx(c)]=1;
+  });
+  
+  // partitions of reads, see get_read_parts in epialleleR.h
+  const std::vector<unsigned int> parts =                                       // first read of every partition
+    get_read_parts(rname_ptr, start_ptr, templid_ptr, rname.size(), *seqxm_ptr, 0);
+  const unsigned int nparts = parts.size()-1;
+  std::vector<T_res> part_res (nparts);
+  
+  // iterating over XM vector within every partition, saving the results when necessary
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+  for (unsigned int p=0; p<nparts; p++) {
+    T_res &res = part_res[p];
+    T_het_map het_map;
+    T_het_map::iterator hint = het_map.end();
+    const T_val map_val = {0};
+    const int cur_rname = rname_ptr[parts[p]];
+    int max_pos = 0;
+    std::vector<unsigned int> hap;                                              // within-context bases of the current read
+    
+    for (unsigned int x=parts[p]; x<parts[p+1]; x++) {
+      const int start_x = start_ptr[x];                                         // start of the current read
+      if (start_x>max_pos) {                                                    // if current position is further downstream
+        spit_results;
+      }
+      const unsigned int str_shft = (strand_ptr[x]-1)<<4;                       // strand shift: 0 for F and 16 for R
+      const unsigned int het_shft_x = het_shft(strand_ptr[x]-1);                // PDR and window counters of the strand
+      const char* seqxm_x = (*seqxm_ptr)[templid_ptr[x]].c_str();               // (*seqxm)[templid[x]] is a reference to a corresponding SEQXM string
+      const unsigned int size_x = (*seqxm_ptr)[templid_ptr[x]].size();          // length of the current read
+      
+      // first, filter reads using their context histograms
+      size_t h_size;                                                            // total size of haplotype
+      double ooctx_meth_frac;                                                   // fraction of o-o-ctx methylated
+      get_hap_stats(ctxhist[templid_ptr[x]], ctx_map, h_size, ooctx_meth_frac);
+      if (ooctx_meth_frac>max_ooctx_meth_frac) continue;                        // skip read if too many o-o-ctx meth bases
+      
+      // then, read-level discordance and windows
+      get_haplotype(seqxm_x, 0, size_x-1, ctx_map, hap);
+      const bool pdr_x = hap.size() && hap.size()>=(size_t)min_length;          // is read included in PDR
+      const bool disc_x = pdr_x && is_discordant(hap);                          // is read discordant
+      
+      // second, walk through XM once again, filling the map
+      size_t k = 0;                                                             // index of the current within-context base
+      for (unsigned int i=0; i<size_x; i++) {                                   // char by char - it's faster this way than using std::string in the cycle
+        const unsigned int idx_to_increase = unpack_ctx_idx(seqxm_x[i]);        // index of context; see the table in epialleleR.h
+        if (idx_to_increase==11) continue;                                      // skip +-
+        hint = het_map.try_emplace(hint, (T_key)(start_x+i), map_val);
+        hint->second[idx_to_increase+str_shft]++;
+        hint->second[9+str_shft]++;                                             // total coverage
+        if (ctx_map[idx_to_increase]) {                                         // if within context
+          uint32_t *het = hint->second.data() + het_shft_x;
+          if (pdr_x) {
+            het[0]++;                                                           // PDR reads
+            het[1] += disc_x;                                                   // discordant reads
+          }
+          if (k+HET_WINDOW<=hap.size()) het[2+get_window_pattern(hap, k)]++;    // window starting here
+          k++;
+        }
+        max_pos = std::max(max_pos, (int)(start_x+i));                          // last position of C in het_map
+      }
+    }
+    spit_results;
+  }
+  
+  Rcpp::DataFrame res = Rcpp::DataFrame::create(                                // final heterogeneity report
+    Rcpp::Named("rname") = concat_parts(part_res, &T_res::rname),               // numeric ids (factor) for reference names
+    Rcpp::Named("strand") = concat_parts(part_res, &T_res::strand),             // numeric ids (factor) for reference strands
+    Rcpp::Named("pos") = concat_parts(part_res, &T_res::pos),                   // position of cytosine
+    Rcpp::Named("context") = concat_parts(part_res, &T_res::ctx),               // cytosine context
+    Rcpp::Named("coverage") = concat_parts(part_res, &T_res::cov),              // cytosine coverage
+    Rcpp::Named("pdr") = concat_parts(part_res, &T_res::pdr),                   // proportion of discordant reads
+    Rcpp::Named("windows") = concat_parts(part_res, &T_res::nwin),              // number of reads with windows starting at this cytosine
+    Rcpp::Named("epipolymorphism") = concat_parts(part_res, &T_res::epipoly),   // epipolymorphism of windows
+    Rcpp::Named("entropy") = concat_parts(part_res, &T_res::entropy)            // methylation entropy of windows
+  );
+  
+  Rcpp::IntegerVector col_rname = res["rname"];                                 // making rname a factor
+  col_rname.attr("class") = "factor";
+  col_rname.attr("levels") = rname.attr("levels");
+  
+  Rcpp::IntegerVector col_strand = res["strand"];                               // making strand a factor
+  col_strand.attr("class") = "factor";
+  col_strand.attr("levels") = strand.attr("levels");
+  
+  Rcpp::CharacterVector contexts = Rcpp::CharacterVector::create(               // base contexts
+    "NA1","CHH","NA3","NA4","NA5","CHG","CG"
+  );
+  Rcpp::IntegerVector col_context = res["context"];                             // making context a factor
+  col_context.attr("class") = "factor";
+  col_context.attr("levels") = contexts;
+  
+  return res;
+}
+
+
+// Region-level (BED) heterogeneity report
+// PRE-SORTED DATASET IS A REQUIREMENT.
+// 
+// Calculates heterogeneity metrics for every BED region using haplotypes
+// clipped to region boundaries (as in region-level lMHL report): read (read
+// pair) is included in PDR if it has at least min_length within-context bases
+// inside the region, and only windows within the region are counted.
+// Epipolymorphism and entropy are computed for every window position and
+// then averaged over all window positions of the region. Strands are not
+// distinguished.
+// Output report is a data.frame with five columns and rows for every region
+// in original BED order: nreads, pdr, windows, epipolymorphism, entropy
+// 
+// 1) regions are ordered by (rname, start), reads are already ordered
+// 2) reference sequences are processed in parallel (OpenMP), every one with a
+//    single sweep: regions enter active list when their start is within the
+//    current read, and leave it (and are summarised) when they end before the
+//    current read start
+// 
+
+// [[Rcpp::export]]
+Rcpp::DataFrame rcpp_heterogeneity_bed_report(Rcpp::DataFrame &df,              // data frame with BAM data
+                                              Rcpp::DataFrame &bed,             // BED data
+                                              const std::string ctx,            // context string for bases to report
+                                              const int min_length,             // min number of within-context bases for a read to be included in PDR
+                                              const double max_ooctx_meth_frac, // maximum fraction of methylated to total out-of-context bases (max out-of-context beta value)
+                                              const int nthreads)               // number of OpenMP threads
+{
+  Rcpp::IntegerVector rname   = df["rname"];                                    // template rname
+  Rcpp::IntegerVector start   = df["start"];                                    // template start
+  Rcpp::IntegerVector templid = df["templid"];                                  // template id, effectively holds indexes of corresponding std::string in std::vector
+  
+  Rcpp::XPtr<std::vector<std::string>> seqxm((SEXP)df.attr("seqxm_xptr"));      // merged refspaced packed template SEQXMs, as a pointer to std::vector<std::string>
+  
+  Rcpp::IntegerVector reg_chr   = bed["seqnames"];                              // BED rname
+  Rcpp::IntegerVector reg_start = bed["start"];                                 // BED start
+  Rcpp::IntegerVector reg_end   = bed["end"];                                   // BED end
+  
+  // raw pointers to be used within threads
+  const int *rname_ptr = rname.begin(), *start_ptr = start.begin(), *templid_ptr = templid.begin();
+  const int *reg_chr_ptr = reg_chr.begin(), *reg_start_ptr = reg_start.begin(), *reg_end_ptr = reg_end.begin();
+  const std::vector<std::string> *seqxm_ptr = seqxm.get();
+  const ctx_hist_view ctxhist(df, *seqxm, nthreads);                            // per-template context histograms
+  const size_t nreads = rname.size(), nregs = reg_start.size();
+  
+  // array of contexts to include
+  unsigned int ctx_map [16] = {0};
+  std::for_each(ctx.begin(), ctx.end(), [&ctx_map] (unsigned int const &c) {
+    ctx_map[ctx_to_idx(c)]=1;
+  });
+  
+  // regions ordered by (rname, start), regions on unknown references are dropped
+  std::vector<unsigned int> reg_order;
+  reg_order.reserve(nregs);
+  for (unsigned int r=0; r<nregs; r++) {
+    if (reg_chr_ptr[r]!=NA_INTEGER) reg_order.push_back(r);
+  }
+  std::sort(reg_order.begin(), reg_order.end(),
+            [&reg_chr_ptr, &reg_start_ptr] (unsigned int a, unsigned int b) {
+              return reg_chr_ptr[a]!=reg_chr_ptr[b] ? reg_chr_ptr[a]<reg_chr_ptr[b] : reg_start_ptr[a]<reg_start_ptr[b];
+            });
+  
+  // groups of regions on the same reference sequence
+  std::vector<size_t> groups {0};                                               // first region of every group
+  for (size_t i=1; i<reg_order.size(); i++)
+    if (reg_chr_ptr[reg_order[i]]!=reg_chr_ptr[reg_order[i-1]]) groups.push_back(i);
+  groups.push_back(reg_order.size());
+  const int ngroups = reg_order.empty() ? 0 : groups.size()-1;
+  
+  // result
+  std::vector<int> res_nreads (nregs, 0), res_pdr_reads (nregs, 0), res_disc (nregs, 0), res_nwin (nregs, 0);
+  std::vector<double> res_epipoly (nregs, 0), res_entropy (nregs, 0);
+  
+  // window patterns of active regions, by window position
+  typedef boost::container::flat_map<int, std::array<uint32_t, HET_NPAT>> T_win_map;
+  
+  // summarise windows of the region and release them
+  auto spit_windows = [&] (const unsigned int r, T_win_map &win_map) {
+    for (const auto &win : win_map) {
+      uint64_t nwin;
+      double epipoly, entropy;
+      get_window_stats(win.second.data(), nwin, epipoly, entropy);
+      res_nwin[r]++;
+      res_epipoly[r] += epipoly;
+      res_entropy[r] += entropy;
+    }
+    T_win_map().swap(win_map);
+  };
+
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+  for (int g=0; g<ngroups; g++) {
+    const int cur_rname = reg_chr_ptr[reg_order[groups[g]]];
+    // reads of this reference sequence
+    const size_t first = first_read(rname_ptr, start_ptr, nreads, cur_rname, LLONG_MIN);
+    const size_t last = first_read(rname_ptr, start_ptr, nreads, cur_rname, LLONG_MAX);
+    auto next_reg = reg_order.cbegin() + groups[g];                             // next region to become active
+    const auto last_reg = reg_order.cbegin() + groups[g+1];                     // end of regions for this reference
+    std::vector<std::pair<unsigned int, T_win_map>> active;                     // regions that may overlap current and following reads, with their windows
+    std::vector<unsigned int> hap;                                              // within-context bases of the current read
+    
+    for (size_t x=first; x<last; x++) {
+      const int start_x = start_ptr[x];                                         // start of the current read
+      const char* seqxm_x = (*seqxm_ptr)[templid_ptr[x]].c_str();               // (*seqxm)[templid[x]] is a reference to a corresponding SEQXM string
+      const int size_x = (*seqxm_ptr)[templid_ptr[x]].size();                   // length of the current read
+      const int end_x = start_x + size_x - 1;                                   // end of the current read
+      
+      while (next_reg!=last_reg && reg_start_ptr[*next_reg]<=end_x) {           // regions starting within or before the current read become active
+        active.emplace_back(*next_reg, T_win_map());
+        next_reg++;
+      }
+      for (auto &reg : active)                                                  // regions ending before the current read will never overlap again
+        if (reg_end_ptr[reg.first]<start_x) spit_windows(reg.first, reg.second);
+      active.erase(std::remove_if(active.begin(), active.end(),
+                                  [&reg_end_ptr, start_x] (const std::pair<unsigned int, T_win_map> &reg) { return reg_end_ptr[reg.first]<start_x; }),
+                   active.end());
+      if (active.empty()) continue;
+      
+      // read-level filtering, exactly as in per-cytosine report
+      size_t h_size;                                                            // total size of haplotype
+      double ooctx_meth_frac;                                                   // fraction of o-o-ctx methylated
+      get_hap_stats(ctxhist[templid_ptr[x]], ctx_map, h_size, ooctx_meth_frac);
+      if (ooctx_meth_frac>max_ooctx_meth_frac) continue;                        // skip read if too many o-o-ctx meth bases
+      
+      // haplotype clipped to every overlapping region
+      for (auto &reg : active) {
+        const unsigned int r = reg.first;
+        const int from = std::max(start_x, reg_start_ptr[r]) - start_x;         // first base of the read within region
+        const int to = std::min(end_x, reg_end_ptr[r]) - start_x;               // last base of the read within region
+        get_haplotype(seqxm_x, from, to, ctx_map, hap);
+        if (hap.empty()) continue;                                              // no context bases within region
+        res_nreads[r]++;
+        if (hap.size()>=(size_t)min_length) {
+          res_pdr_reads[r]++;
+          res_disc[r] += is_discordant(hap);
+        }
+        for (size_t k=0; k+HET_WINDOW<=hap.size(); k++) {                       // windows within region
+          auto win = reg.second.try_emplace(start_x + (hap[k] >> 1)).first;
+          win->second[get_window_pattern(hap, k)]++;
+        }
+      }
+    }
+    for (auto &reg : active) spit_windows(reg.first, reg.second);               // regions still active at the end of the reference
+  }
+  
+  std::vector<double> res_pdr (nregs, NA_REAL);
+  for (size_t r=0; r<nregs; r++) {
+    if (res_pdr_reads[r]) res_pdr[r] = (double)res_disc[r]/res_pdr_reads[r];    // PDR
+    if (res_nwin[r]) {
+      res_epipoly[r] /= res_nwin[r];                                            // average epipolymorphism of windows
+      res_entropy[r] /= res_nwin[r];                                            // average entropy of windows
+    } else {
+      res_epipoly[r] = res_entropy[r] = NA_REAL;
+    }
+  }
+  
+  Rcpp::DataFrame res = Rcpp::DataFrame::create(                                // final region heterogeneity report
+    Rcpp::Named("nreads") = res_nreads,                                         // number of reads with context bases within region
+    Rcpp::Named("pdr") = res_pdr,                                               // proportion of discordant reads
+    Rcpp::Named("windows") = res_nwin,                                          // number of window positions within region
+    Rcpp::Named("epipolymorphism") = res_epipoly,                               // average epipolymorphism of windows
+    Rcpp::Named("entropy") = res_entropy                                        // average methylation entropy of windows
+  );
+  
+  return res;
+}
+
+
+// test code in R
+//
+
+/*** R
+### epipolymorphism and entropy of a window, given counts of 16 patterns
+window.stats <- function (counts) {
+  p <- counts[counts>0] / sum(counts)
+  c(epipolymorphism=1-sum(p^2), entropy=-sum(p*log2(p))/4)
+}
+window.stats(c(10, rep(0, 14), 10))  # two patterns, equally frequent
+window.stats(rep(1, 16))             # all patterns, maximum heterogeneity
+
+bam <- preprocessBam(system.file("extdata", "amplicon010meth.bam", package="epialleleR"))
+het <- rcpp_heterogeneity_report(bam, "zZ", 4, 0.1, 1)
+# microbenchmark::microbenchmark(rcpp_heterogeneity_report(bam, "zZ", 4, 0.1, 1), rcpp_mhl_report(bam, "zZ", 0, 0, 0.1, FALSE, 1), times=10)
+*/
+
+// Sourcing:
+// Rcpp::sourceCpp("rcpp_heterogeneity_report.cpp")
+
+// #############################################################################
@@ -0,0 +1,267 @@
+#include <Rcpp.h>
+#include <array>
+#include "epialleleR.h"
+// using namespace Rcpp;
+
+// Pairwise linkage of methylation states of within-context bases.
+// PRE-SORTED DATASET IS EXPECTED (reads are scanned in full otherwise).
+//
+// For every target area, 2x2 tables of methylation states are counted for all
+// pairs of within-context positions that are not more than max_distance bases
+// apart and covered by the same read (read pair). Reads overlapping the
+// target by at least min_overlap bases are clipped to the target boundaries,
+// and positions of reverse strand bases are offset by reverse_offset (as in
+// rcpp_extract_patterns) to merge strands of symmetric contexts.
+//
+// 1) positions of within-context bases are collected and indexed
+// 2) reads are converted to haplotypes of position indices and methylation
+//    states (taken from bit-parallel per-read states, T_ctx_bits, instead of
+//    decoding SEQXM strings); the maximum index distance of co-covered positions within
+//    max_distance is known for every position after that, therefore counters
+//    are allocated as a band of the triangular matrix
+// 3) every pair of bases of every haplotype increments its counter
+// 4) pairs covered by at least min_coverage reads are returned column-major,
+//    i.e., as an upper triangular column-compressed sparse matrix, together
+//    with r^2 and D' (methylated state is an allele; NA for monomorphic pairs)
+// Targets are processed in parallel.
+//
+// Return value: a list (one element per target) of lists with:
+// pos (positions), i (0-based rows), p (column pointers), n11, n10, n01, n00
+// (numbers of reads with methylated (1) or unmethylated (0) row and column
+// positions), r2 and dprime
+
+// [[Rcpp::plugins(cpp17)]]
+
+// 2x2 table: n00, n01, n10, n11 (row position state << 1 | column position state)
+typedef std::array<uint32_t, 4> T_table;
+
+// Linkage of a single target, filled without any calls to R API
+struct T_linkage {
+  std::vector<int> pos;                                                         // positions
+  std::vector<int> i, p;                                                        // 0-based row indices and column pointers
+  std::vector<T_table> tables;                                                  // counts
+  std::vector<double> r2, dprime;                                               // linkage measures
+};
+
+// r^2 and D' for a 2x2 table
+inline void get_linkage(const T_table &table, double &r2, double &dprime)
+{
+  const double n = table[0] + table[1] + table[2] + table[3];
+  const double pa = (table[2] + table[3]) / n;                                  // frequency of methylated row position
+  const double pb = (table[1] + table[3]) / n;                                  // frequency of methylated column position
+  const double d = table[3] / n - pa * pb;                                      // linkage disequilibrium
+  const double denom = pa * (1 - pa) * pb * (1 - pb);
+  r2 = denom>0 ? d * d / denom : NA_REAL;
+  const double dmax = d<0 ? std::min(pa * pb, (1 - pa) * (1 - pb)) : std::min(pa * (1 - pb), (1 - pa) * pb);
+  dprime = denom>0 && dmax>0 ? d / dmax : NA_REAL;
+}
+
+// linkage of one target from reads [first, last)
+void get_target_linkage(const int *rname, const int *strand, const int *start,
+                        const int *templid, const std::vector<std::string> &seqxm,
+                        const size_t first, const size_t last,
+                        const int target_rname, const int target_start,
+                        const int target_end, const signed int min_overlap,
+                        const T_ctx_bits &bits,
+                        const unsigned int reverse_offset,
+                        const unsigned int max_distance,
+                        const unsigned int min_coverage,
+                        T_linkage &res)
+{
+  // calls f(x, pos, meth) for every within-context base of every read
+  // overlapping the target, clipped to the target boundaries
+  auto for_each_base = [&] (auto f) {
+    for (size_t x=first; x<last; x++) {
+      if (rname[x]!=target_rname) continue;
+      const int start_x = start[x];                                             // start position of the current read
+      const int end_x = start_x + seqxm[templid[x]].size() - 1;                 // end position of the current read
+      const int over_start_x = std::max(start_x, target_start);                 // start of overlapped area
+      const int over_end_x = std::min(end_x, target_end);                       // end of overlapped area
+      if (over_end_x - over_start_x + 1 < min_overlap) continue;                // doesn't overlap the target
+      const int offset_x = strand[x]==2 ? reverse_offset : 0;                   // offset coordinates of reverse strand for symmetric methylation
+      bits.for_each_covered(x, over_start_x - offset_x, over_end_x - offset_x,  // set bits instead of char by char
+                            [&] (const int p, const bool meth) { f(x, p, meth); });
+    }
+  };
+  
+  // 1) positions
+  std::vector<int> &pos = res.pos;
+  for_each_base([&] (const size_t x, const int p, const bool meth) { pos.push_back(p); });
+  std::sort(pos.begin(), pos.end());
+  pos.erase(std::unique(pos.begin(), pos.end()), pos.end());
+  const size_t npos = pos.size();
+  
+  // 2) haplotypes of position indices and states, {31bit:index, 1bit:meth}
+  std::vector<uint32_t> haps;
+  std::vector<size_t> hap_off {0};                                              // first base of every haplotype
+  size_t prev_x = SIZE_MAX;
+  for_each_base([&] (const size_t x, const int p, const bool meth) {
+    if (x!=prev_x && prev_x!=SIZE_MAX) hap_off.push_back(haps.size());
+    prev_x = x;
+    const uint32_t idx = std::lower_bound(pos.begin(), pos.end(), p) - pos.begin();
+    haps.push_back((idx << 1) | meth);
+  });
+  hap_off.push_back(haps.size());
+  
+  // band width: max index distance of co-covered positions within max_distance
+  std::vector<uint32_t> band (npos, 0);
+  for (size_t h=0; h+1<hap_off.size(); h++) {
+    size_t v = hap_off[h];
+    for (size_t u=hap_off[h]; u<hap_off[h+1]; u++) {
+      const uint32_t iu = haps[u] >> 1;
+      if (v<u) v = u;
+      while (v+1<hap_off[h+1] && (unsigned int)(pos[haps[v+1] >> 1] - pos[iu]) <= max_distance) v++;
+      band[iu] = std::max(band[iu], (haps[v] >> 1) - iu);
+    }
+  }
+  std::vector<size_t> band_off (npos+1, 0);
+  for (size_t a=0; a<npos; a++) band_off[a+1] = band_off[a] + band[a];
+  
+  // 3) counting
+  std::vector<T_table> tables (band_off[npos], T_table {0});
+  for (size_t h=0; h+1<hap_off.size(); h++) {
+    for (size_t u=hap_off[h]; u<hap_off[h+1]; u++) {
+      const uint32_t iu = haps[u] >> 1;
+      for (size_t v=u+1; v<hap_off[h+1]; v++) {
+        const uint32_t iv = haps[v] >> 1;
+        if (iv<=iu) continue;                                                   // the same position (shouldn't happen)
+        if ((unsigned int)(pos[iv] - pos[iu]) > max_distance) break;
+        tables[band_off[iu] + (iv - iu - 1)][((haps[u] & 1) << 1) | (haps[v] & 1)]++;
+      }
+    }
+  }
+  
+  // 4) column-compressing: counting sort of pairs by column, rows remain ordered
+  std::vector<uint32_t> pair_i, pair_j;
+  std::vector<size_t> pair_t;
+  for (size_t a=0; a<npos; a++) {
+    for (size_t b=0; b<band[a]; b++) {
+      const T_table &table = tables[band_off[a] + b];
+      const uint32_t n = table[0] + table[1] + table[2] + table[3];             // reads covering both positions
+      if (n==0 || n<min_coverage) continue;
+      pair_i.push_back(a);
+      pair_j.push_back(a + b + 1);
+      pair_t.push_back(band_off[a] + b);
+    }
+  }
+  const size_t npairs = pair_i.size();
+  res.p.assign(npos+1, 0);
+  for (size_t c=0; c<npairs; c++) res.p[pair_j[c]+1]++;
+  for (size_t a=0; a<npos; a++) res.p[a+1] += res.p[a];
+  std::vector<int> fill (res.p.begin(), res.p.end()-1);
+  res.i.resize(npairs);
+  res.tables.resize(npairs);
+  res.r2.resize(npairs);
+  res.dprime.resize(npairs);
+  for (size_t c=0; c<npairs; c++) {
+    const int dest = fill[pair_j[c]]++;
+    res.i[dest] = pair_i[c];
+    res.tables[dest] = tables[pair_t[c]];
+    get_linkage(res.tables[dest], res.r2[dest], res.dprime[dest]);
+  }
+}
+
+
+// [[Rcpp::export]]
+Rcpp::List rcpp_linkage(Rcpp::DataFrame &df,                                    // data.frame with BAM data
+                        std::vector<int> target_rname,                          // target rname ids
+                        std::vector<int> target_start,                          // target starts
+                        std::vector<int> target_end,                            // target ends
+                        const signed int min_overlap,                           // min overlap of a read with target
+                        const std::string ctx,                                  // context
+                        const unsigned int reverse_offset,                      // offset of reverse strand positions
+                        const unsigned int max_distance,                        // max distance between positions of a pair
+                        const unsigned int min_coverage,                        // min number of reads covering both positions
+                        const int nthreads)                                     // number of threads
+{
+  const size_t ntargets = target_rname.size();
+  if (target_start.size()!=ntargets || target_end.size()!=ntargets)
+    Rcpp::stop("Target vectors must be of the same length");
+  
+  // walk through the data frame
+  Rcpp::IntegerVector rname = df["rname"];                                      // template rname
+  Rcpp::IntegerVector strand = df["strand"];                                    // template strand
+  Rcpp::IntegerVector start = df["start"];                                      // template start
+  Rcpp::IntegerVector templid = df["templid"];                                  // template id, effectively holds indexes of corresponding std::string in std::vector
+  Rcpp::XPtr<std::vector<std::string>> seqxm((SEXP)df.attr("seqxm_xptr"));      // merged refspaced packed SEQXM strings
+  
+  // array of contexts to count
+  unsigned int ctx_map [16] = {0};
+  std::for_each(ctx.begin(), ctx.end(), [&ctx_map] (unsigned int const &c) {
+    ctx_map[ctx_to_idx(c)]=1;
+  });
+  
+  // raw pointers for threads
+  const int *rname_x = rname.begin();
+  const int *strand_x = strand.begin();
+  const int *start_x = start.begin();
+  const int *templid_x = templid.begin();
+  const size_t nreads = rname.size();
+  
+  // per-read states of within-context bases, built once for all targets;
+  // reads are expected to be sorted by rname and start, and the longest read
+  // tells how far before the target start the overlapping reads may begin
+  const T_ctx_bits bits (rname_x, strand_x, start_x, templid_x, nreads,
+                         *seqxm, ctx_map, reverse_offset, nthreads);
+  
+  // targets in parallel
+  std::vector<T_linkage> linkage (ntargets);
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+  for (int t=0; t<(int)ntargets; t++) {
+    if (target_rname[t]==NA_INTEGER) continue;                                  // rname is not in BAM
+    size_t first = 0, last = nreads;
+    if (bits.sorted) {
+      first = first_read(rname_x, start_x, nreads, target_rname[t], (long long)target_start[t] - (long long)bits.max_size + 1);
+      last = first_read(rname_x, start_x, nreads, target_rname[t], (long long)target_end[t] + 1);
+    }
+    get_target_linkage(rname_x, strand_x, start_x, templid_x, *seqxm, first, last,
+                       target_rname[t], target_start[t], target_end[t],
+                       min_overlap, bits, reverse_offset, max_distance,
+                       min_coverage, linkage[t]);
+  }
+  
+  // wrapping, serially
+  Rcpp::List res (ntargets);
+  for (size_t t=0; t<ntargets; t++) {
+    T_linkage &lnk = linkage[t];
+    if (lnk.p.empty()) lnk.p.push_back(0);                                      // empty matrix still has a column pointer
+    const size_t npairs = lnk.i.size();
+    Rcpp::IntegerVector n00 (npairs), n01 (npairs), n10 (npairs), n11 (npairs);
+    for (size_t c=0; c<npairs; c++) {
+      n00[c] = lnk.tables[c][0];
+      n01[c] = lnk.tables[c][1];
+      n10[c] = lnk.tables[c][2];
+      n11[c] = lnk.tables[c][3];
+    }
+    res[t] = Rcpp::List::create(
+      Rcpp::Named("pos") = lnk.pos,                                             // positions (rows and columns)
+      Rcpp::Named("i") = lnk.i,                                                 // 0-based row indices
+      Rcpp::Named("p") = lnk.p,                                                 // column pointers
+      Rcpp::Named("n11") = n11,                                                 // both methylated
+      Rcpp::Named("n10") = n10,                                                 // row methylated, column unmethylated
+      Rcpp::Named("n01") = n01,                                                 // row unmethylated, column methylated
+      Rcpp::Named("n00") = n00,                                                 // both unmethylated
+      Rcpp::Named("r2") = lnk.r2,                                               // r^2
+      Rcpp::Named("dprime") = lnk.dprime                                        // D'
+    );
+    lnk = T_linkage();                                                          // release memory early
+  }
+  
+  return res;
+}
+
+
+// test code in R
+//
+
+/*** R
+bam <- preprocessBam(system.file("extdata", "amplicon010meth.bam", package="epialleleR"))
+lnk <- rcpp_linkage(bam, 1L, 43124861L, 43126026L, 1, "zZ", 1, 500, 10, 1)
+str(lnk)
+# microbenchmark::microbenchmark(rcpp_linkage(bam, 1L, 43124861L, 43126026L, 1, "zZ", 1, 500, 10, 1), times=10)
+*/
+
+// Sourcing:
+// Rcpp::sourceCpp("rcpp_linkage.cpp")
+
+// #############################################################################
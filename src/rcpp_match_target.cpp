@@ -1,83 +1,487 @@
 #include <Rcpp.h>
+#include <climits>
+#include <tuple>
+#include "epialleleR.h"
 // using namespace Rcpp;
 
 // Matches reads to targets by start *or* end plus/minus tolerance (amplicons)
 // OR overlap (capture).
 // Return value: 1-based target index or NA for non-matched.
-// Only first match is taken.
+// Only first match is taken, OR (*_all functions) all matches are returned
+// in compressed sparse row (CSR) format.
 //
-// Currently this code doesn't take advantage from the fact that both reads and
-// targets can be sorted. Thus it is possible to speed it up quite a bit, using
-// the VCF code as an example. HOWEVER: bed is not sorted intentionally.
+// BED is not sorted intentionally (first match is the first one in BED order),
+// therefore targets are indexed per reference sequence instead: every index
+// returns the smallest BED index among all matching targets, which is exactly
+// the first match. Reads are then matched in parallel.
 
-// MATCH AMPLICON BY POSITION
-// fast, vectorised
-// [[Rcpp::export("rcpp_match_amplicon")]]
-std::vector<int> rcpp_match_amplicon(Rcpp::DataFrame &df,                       // BAM data
-                                     Rcpp::DataFrame &bed,                      // BED data
-                                     const int tolerance)                       // coordinate tolerance
+
+// Targets of one reference sequence sorted by key, with sparse table of
+// smallest BED indices for O(1) range minimum queries.
+// Used to match amplicons by start or end
+class T_range_index {
+  std::vector<int> key;                                                         // sorted keys (target start or end)
+  std::vector<std::vector<int>> table;                                          // table[k][i] = min BED index of targets [i, i+2^k)
+public:
+  void build(std::vector<std::pair<int,int>> &targets) {                        // pairs of key and 0-based BED index
+    std::sort(targets.begin(), targets.end());
+    const size_t n = targets.size();
+    key.resize(n);
+    table.assign(1, std::vector<int>(n));
+    for (size_t i=0; i<n; i++) {
+      key[i] = targets[i].first;
+      table[0][i] = targets[i].second;
+    }
+    for (size_t k=1; ((size_t)1<<k)<=n; k++) {
+      const size_t half = (size_t)1<<(k-1);
+      table.emplace_back(n - 2*half + 1);
+      for (size_t i=0; i<table[k].size(); i++)
+        table[k][i] = std::min(table[k-1][i], table[k-1][i+half]);
+    }
+  }
+  
+  // smallest BED index among targets with min_key <= key <= max_key, or INT_MAX
+  int query(const long long min_key, const long long max_key) const {
+    const size_t lo = std::lower_bound(key.begin(), key.end(), min_key) - key.begin();
+    const size_t hi = std::upper_bound(key.begin(), key.end(), max_key) - key.begin();
+    if (lo>=hi) return INT_MAX;
+    size_t k = 0;
+    while (((size_t)2<<k) <= hi-lo) k++;                                        // largest power of two within the range
+    return std::min(table[k][lo], table[k][hi-((size_t)1<<k)]);
+  }
+  
+  // appends BED indices of all targets with min_key <= key <= max_key
+  void query_all(const long long min_key, const long long max_key, std::vector<int> &out) const {
+    const size_t lo = std::lower_bound(key.begin(), key.end(), min_key) - key.begin();
+    const size_t hi = std::upper_bound(key.begin(), key.end(), max_key) - key.begin();
+    for (size_t i=lo; i<hi; i++) out.push_back(table[0][i]);
+  }
+};
+
+
+// Targets of one reference sequence sorted by start, with implicit (array-
+// based) interval tree on top of them: every node keeps max end and min BED
+// index of its targets, which allows to skip the subtrees that can't contain
+// better match.
+// Used to match capture targets by overlap
+class T_interval_index {
+  std::vector<int> start, end, idx;                                             // targets sorted by start
+  std::vector<int> max_end, min_idx;                                            // per node, root is 1, children of i are 2i and 2i+1
+  
+  void build_node(const size_t node, const size_t lo, const size_t hi) {
+    if (hi-lo==1) {
+      max_end[node] = end[lo];
+      min_idx[node] = idx[lo];
+      return;
+    }
+    const size_t mid = (lo+hi)/2;
+    build_node(2*node, lo, mid);
+    build_node(2*node+1, mid, hi);
+    max_end[node] = std::max(max_end[2*node], max_end[2*node+1]);
+    min_idx[node] = std::min(min_idx[2*node], min_idx[2*node+1]);
+  }
+  
+  void query_node(const size_t node, const size_t lo, const size_t hi,
+                  const size_t prefix, const long long min_end, int &best) const {
+    if (lo>=prefix || max_end[node]<min_end || min_idx[node]>=best) return;     // nothing better here
+    if (hi-lo==1) {
+      best = idx[lo];
+      return;
+    }
+    const size_t mid = (lo+hi)/2;
+    query_node(2*node, lo, mid, prefix, min_end, best);
+    query_node(2*node+1, mid, hi, prefix, min_end, best);
+  }
+  
+  void query_all_node(const size_t node, const size_t lo, const size_t hi,
+                      const size_t prefix, const long long min_end, std::vector<int> &out) const {
+    if (lo>=prefix || max_end[node]<min_end) return;                            // nothing here
+    if (hi-lo==1) {
+      out.push_back(idx[lo]);
+      return;
+    }
+    const size_t mid = (lo+hi)/2;
+    query_all_node(2*node, lo, mid, prefix, min_end, out);
+    query_all_node(2*node+1, mid, hi, prefix, min_end, out);
+  }
+
+public:
+  void build(std::vector<std::tuple<int,int,int>> &targets) {                   // tuples of start, end and 0-based BED index
+    std::sort(targets.begin(), targets.end());
+    const size_t n = targets.size();
+    start.resize(n); end.resize(n); idx.resize(n);
+    for (size_t i=0; i<n; i++)
+      std::tie(start[i], end[i], idx[i]) = targets[i];
+    max_end.resize(4*n);
+    min_idx.resize(4*n);
+    if (n>0) build_node(1, 0, n);
+  }
+  
+  // smallest BED index among targets with start <= max_start and
+  // end >= min_end, or INT_MAX
+  int query(const long long max_start, const long long min_end) const {
+    int best = INT_MAX;
+    const size_t prefix = std::upper_bound(start.begin(), start.end(), max_start) - start.begin();
+    if (prefix>0) query_node(1, 0, start.size(), prefix, min_end, best);
+    return best;
+  }
+  
+  // appends BED indices of all targets with start <= max_start and
+  // end >= min_end
+  void query_all(const long long max_start, const long long min_end, std::vector<int> &out) const {
+    const size_t prefix = std::upper_bound(start.begin(), start.end(), max_start) - start.begin();
+    if (prefix>0) query_all_node(1, 0, start.size(), prefix, min_end, out);
+  }
+};
+
+
+// Per-rname indices of amplicon starts and ends
+class T_amplicon_index {
+  int nchr;                                                                     // max rname (factor level) of targets
+  long long tolerance;                                                          // coordinate tolerance
+  std::vector<T_range_index> start_index, end_index;
+public:
+  T_amplicon_index(Rcpp::DataFrame &bed, const int tol) : nchr(0), tolerance(tol) {
+    Rcpp::IntegerVector ampl_chr = bed["seqnames"];                             // BED rname
+    Rcpp::IntegerVector ampl_start = bed["start"];                              // BED start
+    Rcpp::IntegerVector ampl_end = bed["end"];                                  // BED start
+    
+    for (int i=0; i<ampl_chr.size(); i++)
+      if (ampl_chr[i]!=NA_INTEGER && ampl_chr[i]>nchr) nchr = ampl_chr[i];
+    std::vector<std::vector<std::pair<int,int>>> starts (nchr+1), ends (nchr+1);
+    for (int i=0; i<ampl_chr.size(); i++) {
+      if (ampl_chr[i]==NA_INTEGER || ampl_chr[i]<0) continue;                   // rname is not in BAM
+      starts[ampl_chr[i]].emplace_back(ampl_start[i], i);
+      ends[ampl_chr[i]].emplace_back(ampl_end[i], i);
+    }
+    start_index.resize(nchr+1);
+    end_index.resize(nchr+1);
+    for (int c=0; c<=nchr; c++) {
+      start_index[c].build(starts[c]);
+      end_index[c].build(ends[c]);
+    }
+  }
+  
+  // 0-based BED index of the first matching amplicon or INT_MAX
+  int first(const int chr, const long long rstart, const long long rend) const {
+    if (chr==NA_INTEGER || chr<0 || chr>nchr) return INT_MAX;                   // no amplicons on this rname
+    return std::min(start_index[chr].query(rstart-tolerance, rstart+tolerance),
+                    end_index[chr].query(rend-tolerance, rend+tolerance));
+  }
+  
+  // appends sorted 0-based BED indices of all matching amplicons
+  void all(const int chr, const long long rstart, const long long rend, std::vector<int> &out) const {
+    if (chr==NA_INTEGER || chr<0 || chr>nchr) return;                           // no amplicons on this rname
+    const size_t from = out.size();
+    start_index[chr].query_all(rstart-tolerance, rstart+tolerance, out);
+    end_index[chr].query_all(rend-tolerance, rend+tolerance, out);
+    std::sort(out.begin()+from, out.end());
+    out.erase(std::unique(out.begin()+from, out.end()), out.end());             // matched by both start and end
+  }
+};
+
+
+// Per-rname indices of capture targets
+//
+// overlap = min(rend, cend) - max(rstart, cstart) + 1 >= min_overlap is the
+// same as all of the following:
+//   cend - cstart + 1 >= min_overlap   (checked while building an index)
+//   rend - rstart + 1 >= min_overlap   (checked for every read)
+//   cstart <= rend - min_overlap + 1
+//   cend >= rstart + min_overlap - 1   (the last two - by index query)
+class T_capture_index {
+  int nchr;                                                                     // max rname (factor level) of targets
+  long long min_overlap;                                                        // min overlap of reads and capture targets
+  std::vector<T_interval_index> index;
+public:
+  T_capture_index(Rcpp::DataFrame &bed, const int min_ovl) : nchr(0), min_overlap(min_ovl) {
+    Rcpp::IntegerVector capt_chr = bed["seqnames"];                             // BED rname
+    Rcpp::IntegerVector capt_start = bed["start"];                              // BED start
+    Rcpp::IntegerVector capt_end = bed["end"];                                  // BED start
+    
+    for (int i=0; i<capt_chr.size(); i++)
+      if (capt_chr[i]!=NA_INTEGER && capt_chr[i]>nchr) nchr = capt_chr[i];
+    std::vector<std::vector<std::tuple<int,int,int>>> targets (nchr+1);
+    for (int i=0; i<capt_chr.size(); i++) {
+      if (capt_chr[i]==NA_INTEGER || capt_chr[i]<0) continue;                   // rname is not in BAM
+      if ((long long)capt_end[i] - capt_start[i] + 1 < min_overlap) continue;   // target is too short
+      targets[capt_chr[i]].emplace_back(capt_start[i], capt_end[i], i);
+    }
+    index.resize(nchr+1);
+    for (int c=0; c<=nchr; c++) index[c].build(targets[c]);
+  }
+  
+  // 0-based BED index of the first overlapping target or INT_MAX
+  int first(const int chr, const long long rstart, const long long rend) const {
+    if (chr==NA_INTEGER || chr<0 || chr>nchr) return INT_MAX;                   // no targets on this rname
+    if (rend - rstart + 1 < min_overlap) return INT_MAX;                        // read is too short
+    return index[chr].query(rend - min_overlap + 1, rstart + min_overlap - 1);
+  }
+  
+  // appends sorted 0-based BED indices of all overlapping targets
+  void all(const int chr, const long long rstart, const long long rend, std::vector<int> &out) const {
+    if (chr==NA_INTEGER || chr<0 || chr>nchr) return;                           // no targets on this rname
+    if (rend - rstart + 1 < min_overlap) return;                                // read is too short
+    const size_t from = out.size();
+    index[chr].query_all(rend - min_overlap + 1, rstart + min_overlap - 1, out);
+    std::sort(out.begin()+from, out.end());
+  }
+};
+
+
+// First match for every read
+template <class T_index>
+std::vector<int> match_first(Rcpp::DataFrame &df,                               // BAM data
+                             const T_index &index,                              // target index
+                             const int nthreads)                                // number of threads
 {
   Rcpp::IntegerVector read_chr = df["rname"];                                   // template rname
   Rcpp::IntegerVector read_start = df["start"];                                 // template start
   Rcpp::XPtr<std::vector<std::string>> seqxm((SEXP)df.attr("seqxm_xptr"));      // merged refspaced packed template SEQXMs, as a pointer to std::vector<std::string>
   Rcpp::IntegerVector templid = df["templid"];                                  // template id, effectively holds indexes of corresponding std::string in std::vector
   
-  Rcpp::IntegerVector ampl_chr = bed["seqnames"];                               // BED rname
-  Rcpp::IntegerVector ampl_start = bed["start"];                                // BED start
-  Rcpp::IntegerVector ampl_end = bed["end"];                                    // BED start
+  // raw pointers: no Rcpp API calls within threads
+  const int nreads = read_start.size();
+  const int *read_chr_x = read_chr.begin();
+  const int *read_start_x = read_start.begin();
+  const int *templid_x = templid.begin();
+  const std::vector<std::string> &seqxm_x = *seqxm;
   
-  std::vector<int> res (read_start.size(), NA_INTEGER);
-  for (unsigned int x=0; x<read_start.size(); x++) {
-    // checking for the interrupt
-    if ((x & 0xFFFFF) == 0) Rcpp::checkUserInterrupt();
-    
-    int read_end = read_start[x] + seqxm->at(templid[x]).size() - 1;
-    for (unsigned int i=0; i<ampl_start.size(); i++) {
-      if ((read_chr[x] == ampl_chr[i]) &&
-          ((std::abs(read_start[x] - ampl_start[i]) <= tolerance) ||
-           (std::abs(read_end - ampl_end[i]) <= tolerance))) {
-        res[x] = i+1;
-        break;
-      }
-    }
+  std::vector<int> res (nreads, NA_INTEGER);
+#pragma omp parallel for schedule(static) num_threads(nthreads)
+  for (int x=0; x<nreads; x++) {
+    const long long rstart = read_start_x[x];
+    const long long rend = rstart + seqxm_x[templid_x[x]].size() - 1;
+    const int best = index.first(read_chr_x[x], rstart, rend);
+    if (best!=INT_MAX) res[x] = best+1;
   }
   
   return res;
 }
 
 
-// MATCH CAPTURE BY OVERLAP
-// fast, vectorised
-// [[Rcpp::export("rcpp_match_capture")]]
-std::vector<int> rcpp_match_capture(Rcpp::DataFrame &df,                        // BAM data
-                                    Rcpp::DataFrame &bed,                       // BED data
-                                    const signed int min_overlap)               // min overlap of reads and capture targets
+// All matches for every read, in one sweep: every thread collects matches of
+// a contiguous chunk of reads, and chunks are concatenated afterwards
+template <class T_index>
+Rcpp::List match_all(Rcpp::DataFrame &df,                                       // BAM data
+                     const T_index &index,                                      // target index
+                     const int nthreads)                                        // number of threads
 {
   Rcpp::IntegerVector read_chr = df["rname"];                                   // template rname
   Rcpp::IntegerVector read_start = df["start"];                                 // template start
   Rcpp::XPtr<std::vector<std::string>> seqxm((SEXP)df.attr("seqxm_xptr"));      // merged refspaced packed template SEQXMs, as a pointer to std::vector<std::string>
   Rcpp::IntegerVector templid = df["templid"];                                  // template id, effectively holds indexes of corresponding std::string in std::vector
   
-  Rcpp::IntegerVector capt_chr = bed["seqnames"];                               // BED rname
-  Rcpp::IntegerVector capt_start = bed["start"];                                // BED start
-  Rcpp::IntegerVector capt_end = bed["end"];                                    // BED start
+  // raw pointers: no Rcpp API calls within threads
+  const int nreads = read_start.size();
+  const int *read_chr_x = read_chr.begin();
+  const int *read_start_x = read_start.begin();
+  const int *templid_x = templid.begin();
+  const std::vector<std::string> &seqxm_x = *seqxm;
   
-  std::vector<int> res (read_start.size(), NA_INTEGER);
-  for (unsigned int x=0; x<read_start.size(); x++) {
-    // checking for the interrupt
-    if ((x & 0xFFFFF) == 0) Rcpp::checkUserInterrupt();
-    
-    int read_end = read_start[x] + seqxm->at(templid[x]).size() - 1;
-    for (unsigned int i=0; i<capt_start.size(); i++) {
-      signed int overlap = std::min(read_end, capt_end[i]) - std::max(read_start[x], capt_start[i]) + 1;
-      if ((read_chr[x] == capt_chr[i]) && (overlap >= min_overlap)) {
-        res[x] = i+1;
-        break;
+  const int nchunks = std::max(1, nthreads) * 4;
+  std::vector<std::vector<int>> chunk_target (nchunks);                         // 1-based BED indices
+  std::vector<int> nmatch (nreads, 0);                                          // number of matches per read
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+  for (int t=0; t<nchunks; t++) {
+    const int from = (long long)nreads * t / nchunks;
+    const int to = (long long)nreads * (t+1) / nchunks;
+    std::vector<int> &out = chunk_target[t];
+    for (int x=from; x<to; x++) {
+      const long long rstart = read_start_x[x];
+      const long long rend = rstart + seqxm_x[templid_x[x]].size() - 1;
+      const size_t before = out.size();
+      index.all(read_chr_x[x], rstart, rend, out);
+      nmatch[x] = out.size() - before;
+    }
+    for (int &i : out) i++;
+  }
+  
+  Rcpp::IntegerVector offset (nreads+1);                                        // 0-based offsets of reads
+  for (int x=0; x<nreads; x++) offset[x+1] = offset[x] + nmatch[x];
+  Rcpp::IntegerVector target (offset[nreads]);
+  size_t pos = 0;
+  for (int t=0; t<nchunks; t++) {
+    std::copy(chunk_target[t].begin(), chunk_target[t].end(), target.begin()+pos);
+    pos += chunk_target[t].size();
+  }
+  
+  return Rcpp::List::create(
+    Rcpp::Named("offset") = offset,                                             // matches of read x are target[offset[x]:offset[x+1]]
+    Rcpp::Named("target") = target                                              // 1-based target indices, sorted within reads
+  );
+}
+
+
+// BED report in one pass: reads are matched to targets (first or all
+// matches), thresholded and counted per target and strand without any
+// intermediate per-read vectors. Every thread counts reads of a contiguous
+// chunk into its own accumulator, and accumulators are summed up afterwards.
+// Output: list with numbers of forward and reverse reads per target and
+// numbers of reads passing every combination of thresholds per target (matrix
+// with a row per target and a column per combination). Extra last row is for
+// the reads not matching any target
+template <class T_index>
+Rcpp::List bed_report(Rcpp::DataFrame &df,                                      // BAM data
+                      const T_index &index,                                     // target index
+                      const unsigned int ntargets,                              // number of targets
+                      const bool match_all,                                     // all matches instead of the first one
+                      const bool threshold,                                     // threshold reads, or all reads are passing otherwise
+                      const T_read_thresholds &thresholds,                      // thresholding criteria
+                      const int nthreads)                                       // number of threads
+{
+  Rcpp::IntegerVector read_chr = df["rname"];                                   // template rname
+  Rcpp::IntegerVector read_strand = df["strand"];                               // template strand
+  Rcpp::IntegerVector read_start = df["start"];                                 // template start
+  Rcpp::XPtr<std::vector<std::string>> seqxm((SEXP)df.attr("seqxm_xptr"));      // merged refspaced packed template SEQXMs, as a pointer to std::vector<std::string>
+  Rcpp::IntegerVector templid = df["templid"];                                  // template id, effectively holds indexes of corresponding std::string in std::vector
+  const ctx_hist_view ctxhist(df, *seqxm, nthreads);                            // per-template context histograms
+  
+  // raw pointers: no Rcpp API calls within threads
+  const int nreads = read_start.size();
+  const int *read_chr_x = read_chr.begin();
+  const int *read_strand_x = read_strand.begin();
+  const int *read_start_x = read_start.begin();
+  const int *templid_x = templid.begin();
+  const std::vector<std::string> &seqxm_x = *seqxm;
+  
+  const size_t nrows = ntargets + 1;                                            // targets and non-matching reads
+  const size_t ncomb = thresholds.size();                                       // number of threshold combinations
+  const size_t ncols = 2 + ncomb;                                               // forward, reverse, passing per combination
+  const int nchunks = std::max(1, nthreads);
+  std::vector<std::vector<unsigned int>> chunk_count (nchunks);
+#pragma omp parallel for schedule(static) num_threads(nthreads)
+  for (int t=0; t<nchunks; t++) {
+    const int from = (long long)nreads * t / nchunks;
+    const int to = (long long)nreads * (t+1) / nchunks;
+    std::vector<unsigned int> &count = chunk_count[t];
+    count.assign(nrows * ncols, 0);
+    std::vector<int> hits;                                                      // 0-based target indices of a read
+    std::vector<size_t> passed;                                                 // combinations passed by a read
+    for (int x=from; x<to; x++) {
+      const long long rstart = read_start_x[x];
+      const long long rend = rstart + seqxm_x[templid_x[x]].size() - 1;
+      hits.clear();
+      if (match_all) {
+        index.all(read_chr_x[x], rstart, rend, hits);
+      } else {
+        const int best = index.first(read_chr_x[x], rstart, rend);
+        if (best!=INT_MAX) hits.push_back(best);
+      }
+      if (hits.empty()) hits.push_back(ntargets);                               // read doesn't match any target
+      
+      passed.clear();
+      if (threshold) {
+        thresholds.for_each_pass(ctxhist[templid_x[x]], [&passed] (const size_t c) { passed.push_back(c); });
+      } else {
+        for (size_t c=0; c<ncomb; c++) passed.push_back(c);
+      }
+      
+      const size_t s = read_strand_x[x]==1 ? 0 : 1;                             // factor level 1 is "+"
+      for (const int &r : hits) {
+        unsigned int *row = count.data() + (size_t)r * ncols;
+        row[s]++;
+        for (const size_t &c : passed) row[2+c]++;
       }
     }
   }
   
-  return res;
+  Rcpp::IntegerVector nreads_plus (nrows), nreads_minus (nrows);
+  Rcpp::IntegerMatrix nreads_pass (nrows, ncomb);
+  for (int t=0; t<nchunks; t++) {
+    const std::vector<unsigned int> &count = chunk_count[t];
+    for (size_t r=0; r<nrows; r++) {
+      const unsigned int *row = count.data() + (size_t)r * ncols;
+      nreads_plus[r] += row[0];
+      nreads_minus[r] += row[1];
+      for (size_t c=0; c<ncomb; c++) nreads_pass[c*nrows + r] += row[2+c];
+    }
+  }
+  
+  return Rcpp::List::create(
+    Rcpp::Named("nreads.plus") = nreads_plus,
+    Rcpp::Named("nreads.minus") = nreads_minus,
+    Rcpp::Named("nreads.pass") = nreads_pass
+  );
+}
+
+
+// MATCH AMPLICON BY POSITION
+// fast, vectorised
+// [[Rcpp::export("rcpp_match_amplicon")]]
+std::vector<int> rcpp_match_amplicon(Rcpp::DataFrame &df,                       // BAM data
+                                     Rcpp::DataFrame &bed,                      // BED data
+                                     const int tolerance,                       // coordinate tolerance
+                                     const int nthreads)                        // number of threads
+{
+  const T_amplicon_index index (bed, tolerance);
+  return match_first(df, index, nthreads);
+}
+
+// [[Rcpp::export("rcpp_match_amplicon_all")]]
+Rcpp::List rcpp_match_amplicon_all(Rcpp::DataFrame &df,                         // BAM data
+                                   Rcpp::DataFrame &bed,                        // BED data
+                                   const int tolerance,                         // coordinate tolerance
+                                   const int nthreads)                          // number of threads
+{
+  const T_amplicon_index index (bed, tolerance);
+  return match_all(df, index, nthreads);
+}
+
+
+// MATCH CAPTURE BY OVERLAP
+// fast, vectorised
+// [[Rcpp::export("rcpp_match_capture")]]
+std::vector<int> rcpp_match_capture(Rcpp::DataFrame &df,                        // BAM data
+                                    Rcpp::DataFrame &bed,                       // BED data
+                                    const signed int min_overlap,               // min overlap of reads and capture targets
+                                    const int nthreads)                         // number of threads
+{
+  const T_capture_index index (bed, min_overlap);
+  return match_first(df, index, nthreads);
+}
+
+// [[Rcpp::export("rcpp_match_capture_all")]]
+Rcpp::List rcpp_match_capture_all(Rcpp::DataFrame &df,                          // BAM data
+                                  Rcpp::DataFrame &bed,                         // BED data
+                                  const signed int min_overlap,                 // min overlap of reads and capture targets
+                                  const int nthreads)                           // number of threads
+{
+  const T_capture_index index (bed, min_overlap);
+  return match_all(df, index, nthreads);
+}
+
+
+// BED REPORT
+// fast, vectorised
+// [[Rcpp::export("rcpp_bed_report")]]
+Rcpp::List rcpp_bed_report(Rcpp::DataFrame &df,                                 // BAM data
+                           Rcpp::DataFrame &bed,                                // BED data
+                           const std::string bed_type,                          // "amplicon" or "capture"
+                           const int tolerance,                                 // coordinate tolerance (amplicons)
+                           const signed int min_overlap,                        // min overlap of reads and capture targets
+                           const bool match_all,                                // all matches instead of the first one
+                           const bool threshold,                                // threshold reads
+                           const std::string ctx_meth,                          // methylated context string, e.g. "XZ". NON-EMPTY
+                           const std::string ctx_unmeth,                        // unmethylated context string, e.g. "xz". NON-EMPTY
+                           const std::string ooctx_meth,                        // methylated out-of-context string, e.g. "HU". Can be empty
+                           const std::string ooctx_unmeth,                      // unmethylated out-of-context string, e.g. "hu". Can be empty
+                           const std::vector<unsigned int> min_n_ctx,           // minimum numbers of context bases in xm field
+                           const std::vector<double> min_ctx_meth_frac,         // minimum fractions of methylated to total context bases
+                           const std::vector<double> max_ooctx_meth_frac,       // maximum fractions of methylated to total out-of-context bases
+                           const int nthreads)                                  // number of threads
+{
+  const T_read_thresholds thresholds (ctx_meth, ctx_unmeth, ooctx_meth, ooctx_unmeth,
+                                      min_n_ctx, min_ctx_meth_frac, max_ooctx_meth_frac);
+  const unsigned int ntargets = bed.nrows();
+  if (bed_type=="amplicon") {
+    const T_amplicon_index index (bed, tolerance);
+    return bed_report(df, index, ntargets, match_all, threshold, thresholds, nthreads);
+  } else if (bed_type=="capture") {
+    const T_capture_index index (bed, min_overlap);
+    return bed_report(df, index, ntargets, match_all, threshold, thresholds, nthreads);
+  }
+  Rcpp::stop("Unknown BED type: " + bed_type);
 }
 
 
@@ -18,11 +18,16 @@
 // 1) all XM positions counted in int[16]: index is equal to char+2>>2&00001111
 // 2) when gap in reads or another chr - spit map to res, clear map
 // 3) spit if within context and same context in more than 50% of the reads
+// 4) if merge_strands: values of reverse strand CG (CHG) are added to forward
+//    strand values at pos-1 (pos-2), strand of such cytosines is reported as *
+// 5) reads are split into partitions at reference changes or gaps, partitions
+//    are processed in parallel (OpenMP) and results are concatenated in order
 // 
 // ctx_to_idx conversion is described in epialleleR.h file
 // 
 
-// lMHL numerator and denominator lookup tables are precomputed using nrS(n)
+// lMHL numerator and denominator lookup table is precomputed using nrS(n) and
+// shared between calls, see get_mhl_lookup(hmax) in epialleleR.h
 //
 // Triangular sequence, nth element
 // uint64_t T(uint64_t n) {
@@ -35,19 +40,16 @@
 //   if (n<2) return n;
 //   return S(n-1) + T(n);
 // }
-// S can be simplified to non-recursive versions
-uint64_t nrS(uint64_t n)
-{
-  if (n<2) return n;
-  return (n*(n+1)*(n+2))/6;
-}
+// S can be simplified to non-recursive version nrS(n), see epialleleR.h
 
 // [[Rcpp::export]]
 Rcpp::DataFrame rcpp_mhl_report(Rcpp::DataFrame &df,                            // data frame with BAM data
                                 const std::string ctx,                          // context string for bases to report,
-                                int hmax,                                       // maximum length of a computation window (limit for l in lMHL formula)
+                                const int hmax,                                 // maximum length of a computation window (limit for l in lMHL formula)
                                 const int hmin,                                 // ignore haplotypes smaller than hmin
-                                const double max_ooctx_meth_frac)               // maximum fraction of methylated to total out-of-context bases (max out-of-context beta value)
+                                const double max_ooctx_meth_frac,               // maximum fraction of methylated to total out-of-context bases (max out-of-context beta value)
+                                const bool merge_strands,                       // merge strands of symmetric contexts (CG, CHG)
+                                const int nthreads)                             // number of OpenMP threads
 {
   // walking trough bunch of reads <- filling the map
   // pos -> { 0: rname,   1: pos,       2: 'H',  3: numer,  4: denom,  5: 'U',  6: 'X',  7: 'Z',  # + strand
@@ -63,38 +65,51 @@ Rcpp::DataFrame rcpp_mhl_report(Rcpp::DataFrame &df,
   
   Rcpp::XPtr<std::vector<std::string>> seqxm((SEXP)df.attr("seqxm_xptr"));      // merged refspaced packed template SEQXMs, as a pointer to std::vector<std::string>
   
+  // raw pointers to be used within threads
+  const int *rname_ptr = rname.begin(), *strand_ptr = strand.begin(), *start_ptr = start.begin(), *templid_ptr = templid.begin();
+  const std::vector<std::string> *seqxm_ptr = seqxm.get();
+  const ctx_hist_view ctxhist(df, *seqxm);                                      // per-template context histograms
+  
   // main typedefs
   typedef uint64_t T_key;                                                       // {64bit:pos}
   typedef std::array<uint64_t, 32> T_val;                                       // {0:rname, 1:pos, 8,25:h_size, 9,25:coverage, 3,19:numerator, 4,20:denominator, and 10 more for 11 valid chars * two strands}
   typedef boost::container::flat_map<T_key, T_val> T_mhl_map;                   // attaboy
   
+  // partial results, one per partition of reads
+  struct T_res {
+    std::vector<int> rname, strand, pos, ctx, cov;
+    std::vector<double> hlen, mhl;
+  };
+  
 // macros
 #define spit_results {                                                                           /* save aggregated counts */ \
   for (T_mhl_map::iterator it=mhl_map.begin(); it!=mhl_map.end(); it++) {                                                     \
     for (int s=0; s<2; s++) {                                                                      /* iterate over strands */ \
       str_shft = s<<4;                                                               /* strand shift: 0 for F and 16 for R */ \
-      if (it->second[9+str_shft]==0) continue;                                                      /* skip if not covered */ \
-      it->second[9+str_shft] /= 2;                                                                   /* halve the coverage */ \
-      if (it->second[12+str_shft] > it->second[9+str_shft]) continue;                                /* skip if most are . */ \
-      else if ((it->second[2+str_shft] + it->second[10+str_shft]) > it->second[9+str_shft])                                   \
-        max_freq_idx=2;                                                                                               /* H */ \
-      else if ((it->second[6+str_shft] + it->second[14+str_shft]) > it->second[9+str_shft])                                   \
-        max_freq_idx=6;                                                                                               /* X */ \
-      else if ((it->second[7+str_shft] + it->second[15+str_shft]) > it->second[9+str_shft])                                   \
-        max_freq_idx=7;                                                                                               /* Z */ \
-      else continue;                                                                              /* skip if none is > 50% */ \
+      max_freq_idx = get_major_ctx_idx(it->second, str_shft);                  /* context in more than 50% of the reads or 0 */ \
       if (ctx_map[max_freq_idx]) {                                                                        /* if within ctx */ \
-        res_strand.push_back(s+1);                                                                               /* strand */ \
-        res_pos.push_back(it->first);                                                                               /* pos */ \
-        res_ctx.push_back(max_freq_idx);                                                                        /* context */ \
-        const int cov = it->second[max_freq_idx+str_shft] + it->second[(max_freq_idx+str_shft) | 8];                          \
-        res_cov.push_back(cov);                                                                           /* meth + unmeth */ \
-        res_hlen.push_back((double)it->second[8+str_shft]/cov);                                        /* average hap size */ \
-        res_mhl.push_back((double)it->second[3+str_shft]/it->second[4+str_shft]);                                  /* lMHL */ \
+        uint64_t cov = it->second[max_freq_idx+str_shft] + it->second[(max_freq_idx+str_shft) | 8];         /* meth + unmeth */ \
+        uint64_t hlen = it->second[8+str_shft];                                                      /* sum of hap sizes */ \
+        uint64_t numer = it->second[3+str_shft], denom = it->second[4+str_shft];                 /* lMHL numerator, denom */ \
+        int out_strand = s+1, out_pos = it->first;                                                     /* strand and pos */ \
+        if (merge_strands &&                                                                                 /* if merging */ \
+            merge_sym_strands(mhl_map, it, max_freq_idx, s, 16, out_pos, [&] (const auto &mate) {                             \
+              cov += mate[max_freq_idx+16] + mate[(max_freq_idx+16) | 8];                                /* merge coverage */ \
+              hlen += mate[8+16];                                                                       /* merge hap sizes */ \
+              numer += mate[3+16];                                                                 /* merge lMHL numerator */ \
+              denom += mate[4+16];                                                               /* merge lMHL denominator */ \
+            }))                                                                                                               \
+          out_strand = 3;                                                                                 /* strand is '*' */ \
+        res.strand.push_back(out_strand);                                                                        /* strand */ \
+        res.pos.push_back(out_pos);                                                                                 /* pos */ \
+        res.ctx.push_back(max_freq_idx);                                                                        /* context */ \
+        res.cov.push_back(cov);                                                                           /* meth + unmeth */ \
+        res.hlen.push_back((double)hlen/cov);                                                          /* average hap size */ \
+        res.mhl.push_back((double)numer/denom);                                                                    /* lMHL */ \
       }                                                                                                                       \
     }                                                                                                                         \
   }                                                                                                                           \
-  res_rname.resize(res_strand.size(), map_val[0]);                                                          /* same rname! */ \
+  res.rname.resize(res.strand.size(), map_val[0]);                                                          /* same rname! */ \
   max_pos=0;                                                                                                                  \
   mhl_map.clear();                                                                                                            \
   hint = mhl_map.end();                                                                                                       \
@@ -106,105 +121,90 @@ Rcpp::DataFrame rcpp_mhl_report(Rcpp::DataFrame &df,
     ctx_map[ctx_to_idx(c)]=1;
   });
   
-  // precomputed lMHL numerator lookup table
-  const size_t mhl_lookup_len = 65536;
-  uint64_t mhl_lookup[mhl_lookup_len] = {0};
-  hmax = (hmax>0) ? std::min((size_t)hmax, mhl_lookup_len) : mhl_lookup_len ;   // number of context bases is always in range [1; mhl_lookup_len]
-  for (size_t n=0; n<(size_t)hmax; n++) {
-    mhl_lookup[n] = nrS(n);                                                     // filling the lMHL values for faster computations
-  }
-  std::fill_n(mhl_lookup+hmax, mhl_lookup_len-hmax, nrS(hmax));                 // if hmax < mhl_lookup_len - fill the rest of the lookup table with it
-  
-  // lMHL numerator buffer for current XM
-  size_t num_buf_len = 8192;                                                    // maximum, though expandable length of numerator buffer
-  uint64_t *num_buf  = (uint64_t*) malloc(num_buf_len * sizeof(uint64_t));      // numerator buffer
-
-  // result
-  std::vector<int> res_rname, res_strand, res_pos, res_ctx, res_cov;
-  std::vector<double> res_hlen, res_mhl;
-  size_t nitems = std::min(rname.size()*pow(ctx.size()<<2,2), 3e+9);
-  res_rname.reserve(nitems); res_strand.reserve(nitems);
-  res_pos.reserve(nitems); res_ctx.reserve(nitems);
-  res_cov.reserve(nitems); res_hlen.reserve(nitems); res_mhl.reserve(nitems);
+  // precomputed lMHL numerator lookup table, shared between calls
+  const uint64_t *mhl_lookup = get_mhl_lookup(hmax);
   
-  // iterating over XM vector, saving the results when necessary
-  T_mhl_map mhl_map;
-  T_mhl_map::iterator hint;
-  T_val map_val = {0};
-  int max_pos = 0;
-  unsigned int max_freq_idx, str_shft;
+  // partitions of reads, see get_read_parts in epialleleR.h
+  const int max_gap = merge_strands ? 2 : 0;                                    // keep both cytosines of symmetric context in the same map
+  const std::vector<unsigned int> parts =                                       // first read of every partition
+    get_read_parts(rname_ptr, start_ptr, templid_ptr, rname.size(), *seqxm_ptr, max_gap);
+  const unsigned int nparts = parts.size()-1;
+  std::vector<T_res> part_res (nparts);
   
-  mhl_map.reserve(100000);                                                      // reserving helps?
-  for (unsigned int x=0; x<rname.size(); x++) {
-    // checking for the interrupt
-    if ((x & 0xFFFF) == 0) Rcpp::checkUserInterrupt();                          // every ~65k reads
-    
-    const int start_x = start[x];                                               // start of the current read
-    if ((start_x>max_pos) || ((uint64_t)rname[x]!=map_val[0])) {                // if current position is further downstream or another reference
-      spit_results;
-      map_val[0] = rname[x];
-    }
-    str_shft = (strand[x]-1)<<4;                                                // strand shift: 0 for F and 16 for R
-    const char* seqxm_x = seqxm->at(templid[x]).c_str();                        // seqxm->at(templid[x]) is a reference to a corresponding SEQXM string
-    const unsigned int size_x = seqxm->at(templid[x]).size();                   // length of the current read
+  // iterating over XM vector within every partition, saving the results when necessary
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+  for (unsigned int p=0; p<nparts; p++) {
+    T_res &res = part_res[p];
+    T_mhl_map mhl_map;
+    T_mhl_map::iterator hint = mhl_map.end();
+    T_val map_val = {0};
+    int max_pos = 0;
+    unsigned int max_freq_idx, str_shft;
+    std::vector<uint64_t> num_buf (8192);                                       // lMHL numerator buffer for current XM, per thread
     
-    // first, prefill lMHL numerator buffer in first pass of XM
-    if (num_buf_len < size_x) {
-      num_buf_len = size_x;                                                     // new size
-      num_buf  = (uint64_t*) realloc(num_buf, num_buf_len * sizeof(uint64_t));  // expand numerator buffer
-      if (!num_buf) Rcpp::stop("Unable to allocate memory");                    // check memory allocation
-    }
-    std::memset(num_buf,  0, size_x * sizeof(uint64_t));                        // clean the buffer
-    size_t mh_start = 0, mh_end = 0, mh_size = 0, h_size = 0;                   // start, end and size of the current methylated stretch (number of ctx bases); total size of haplotype
-    size_t ooctx_map [16] = {0};                                                // counter array for methylated and unmethylated out-of-context bases
-    for (unsigned int i=0; i<size_x; i++) {                                     // first pass to compute local lMHL values, char by char
-      const unsigned int base_idx = unpack_ctx_idx(seqxm_x[i]);                 // index of current base context; see the table in epialleleR.h
-      if (ctx_map[base_idx]) {                                                  // if within context
-        h_size++;                                                               // haplotype size++
-        if (base_idx<8) {                                                       // if uppercase (methylated stretch started/continues)
-          if (!mh_size) mh_start = i;                                           // store start position of methylated stretch
-          mh_end = i;                                                           // store end position of methylated stretch
-          mh_size++;                                                            // methylated stretch size++
-        } else if (mh_size) {                                                   // if lowercase and after non-0-length methylated stretch
-          std::fill(num_buf+mh_start, num_buf+mh_end+1, mhl_lookup[mh_size]);   // set values to nrS(mh_size) within methylated stretch
-          mh_size = 0;                                                          // reset the size
+    map_val[0] = rname_ptr[parts[p]];
+    for (unsigned int x=parts[p]; x<parts[p+1]; x++) {
+      const int start_x = start_ptr[x];                                         // start of the current read
+      if (start_x>max_pos+max_gap) {                                            // if current position is further downstream
+        spit_results;
+      }
+      str_shft = (strand_ptr[x]-1)<<4;                                          // strand shift: 0 for F and 16 for R
+      const char* seqxm_x = (*seqxm_ptr)[templid_ptr[x]].c_str();               // (*seqxm)[templid[x]] is a reference to a corresponding SEQXM string
+      const unsigned int size_x = (*seqxm_ptr)[templid_ptr[x]].size();          // length of the current read
+      
+      // first, filter reads using their context histograms
+      size_t h_size;                                                            // total size of haplotype
+      double ooctx_meth_frac;                                                   // fraction of o-o-ctx methylated
+      get_hap_stats(ctxhist[templid_ptr[x]], ctx_map, h_size, ooctx_meth_frac);
+      if ((int)h_size<hmin || ooctx_meth_frac>max_ooctx_meth_frac) continue;    // skip read if haplotype is smaller than hmin or too many o-o-ctx meth bases
+      
+      // then, prefill lMHL numerator buffer in first pass of XM
+      if (num_buf.size() < size_x) num_buf.resize(size_x);                      // expand numerator buffer
+      std::fill_n(num_buf.begin(), size_x, 0);                                  // clean the buffer
+      size_t mh_start = 0, mh_end = 0, mh_size = 0;                             // start, end and size of the current methylated stretch (number of ctx bases)
+      for (unsigned int i=0; i<size_x; i++) {                                   // first pass to compute local lMHL values, char by char
+        const unsigned int base_idx = unpack_ctx_idx(seqxm_x[i]);               // index of current base context; see the table in epialleleR.h
+        if (ctx_map[base_idx]) {                                                // if within context
+          if (base_idx<8) {                                                     // if uppercase (methylated stretch started/continues)
+            if (!mh_size) mh_start = i;                                         // store start position of methylated stretch
+            mh_end = i;                                                         // store end position of methylated stretch
+            mh_size++;                                                          // methylated stretch size++
+          } else if (mh_size) {                                                 // if lowercase and after non-0-length methylated stretch
+            std::fill(num_buf.begin()+mh_start, num_buf.begin()+mh_end+1, mhl_lookup[std::min(mh_size, MHL_LOOKUP_LEN-1)]);  // set values to nrS(mh_size) within methylated stretch
+            mh_size = 0;                                                        // reset the size
+          }
         }
-      } else {                                                                  // only if out-of-context
-        ooctx_map[base_idx]++;                                                  // increment the counter of that symbol
       }
+      if (mh_size) {                                                            // save last non-0-length methylated stretch
+        std::fill(num_buf.begin()+mh_start, num_buf.begin()+mh_end+1, mhl_lookup[std::min(mh_size, MHL_LOOKUP_LEN-1)]);
+      }
+      const uint64_t denom = mhl_lookup[std::min(h_size, MHL_LOOKUP_LEN-1)];    // lMHL denominator, the same for every position
+      
+      // second, walk through XM once again, filling the map
+      for (unsigned int i=0; i<size_x; i++) {                                   // char by char - it's faster this way than using std::string in the cycle
+        const unsigned int idx_to_increase = unpack_ctx_idx(seqxm_x[i]);        // index of context; see the table in epialleleR.h
+        if (idx_to_increase==11) continue;                                      // skip +-
+        map_val[1] = start_x+i;                                                 // current position
+        hint = mhl_map.try_emplace(hint, (T_key)(map_val[1]), map_val);
+        hint->second[idx_to_increase+str_shft]++;
+        hint->second[9+str_shft]++;                                             // total coverage
+        hint->second[8+str_shft] += h_size;                                     // sum haplotype sizes
+        hint->second[3+str_shft] += num_buf[i];                                 // lMHL numerator
+        hint->second[4+str_shft] += denom;                                      // lMHL denominator
+      }
+      if ((uint64_t)max_pos<map_val[1]) max_pos=map_val[1];                     // last position of C in mhl_map
     }
-    size_t ooctx_meth = ooctx_map[2]+ooctx_map[5]+ooctx_map[6]+ooctx_map[7];    // sum of o-o-ctx methylated
-    size_t ooctx_unmeth = ooctx_map[10]+ooctx_map[13]+ooctx_map[14]+ooctx_map[15];  // sum of o-o-ctx unmethylated
-    double ooctx_meth_frac = (double)ooctx_meth / (ooctx_meth+ooctx_unmeth);    // fraction of o-o-ctx methylated
-    if ((int)h_size<hmin || ooctx_meth_frac>max_ooctx_meth_frac) continue;      // skip read if haplotype is smaller than hmin or too many o-o-ctx meth bases
-    if (mh_size) {                                                              // save last non-0-length methylated stretch
-      std::fill(num_buf+mh_start, num_buf+mh_end+1, mhl_lookup[mh_size]);
-    }
-    
-    // second, walk through XM once again, filling the map
-    for (unsigned int i=0; i<size_x; i++) {                                     // char by char - it's faster this way than using std::string in the cycle
-      const unsigned int idx_to_increase = unpack_ctx_idx(seqxm_x[i]);          // index of context; see the table in epialleleR.h
-      if (idx_to_increase==11) continue;                                        // skip +-
-      map_val[1] = start_x+i;                                                   // current position
-      hint = mhl_map.try_emplace(hint, (T_key)(map_val[1]), map_val);
-      hint->second[idx_to_increase+str_shft]++;
-      hint->second[9+str_shft]++;                                               // total coverage
-      hint->second[8+str_shft] += h_size;                                       // sum haplotype sizes
-      hint->second[3+str_shft] += num_buf[i];                                   // lMHL numerator
-      hint->second[4+str_shft] += mhl_lookup[h_size];                           // lMHL denominator
-    }
-    if ((uint64_t)max_pos<map_val[1]) max_pos=map_val[1];                       // last position of C in mhl_map
+    spit_results;
   }
-  spit_results;
   
   Rcpp::DataFrame res = Rcpp::DataFrame::create(                                // final CX report
-    Rcpp::Named("rname") = res_rname,                                           // numeric ids (factor) for reference names
-    Rcpp::Named("strand") = res_strand,                                         // numeric ids (factor) for reference strands
-    Rcpp::Named("pos") = res_pos,                                               // position of cytosine
-    Rcpp::Named("context") = res_ctx,                                           // cytosine context
-    Rcpp::Named("coverage") = res_cov,                                          // cytosine coverage
-    Rcpp::Named("length") = res_hlen,                                           // average haplotype length
-    Rcpp::Named("lmhl") = res_mhl                                               // lMHL value
+    Rcpp::Named("rname") = concat_parts(part_res, &T_res::rname),               // numeric ids (factor) for reference names
+    Rcpp::Named("strand") = concat_parts(part_res, &T_res::strand),             // numeric ids (factor) for reference strands
+    Rcpp::Named("pos") = concat_parts(part_res, &T_res::pos),                   // position of cytosine
+    Rcpp::Named("context") = concat_parts(part_res, &T_res::ctx),               // cytosine context
+    Rcpp::Named("coverage") = concat_parts(part_res, &T_res::cov),              // cytosine coverage
+    Rcpp::Named("length") = concat_parts(part_res, &T_res::hlen),               // average haplotype length
+    Rcpp::Named("lmhl") = concat_parts(part_res, &T_res::mhl)                   // lMHL value
   );
   
   Rcpp::IntegerVector col_rname = res["rname"];                                 // making rname a factor
@@ -213,7 +213,10 @@ Rcpp::DataFrame rcpp_mhl_report(Rcpp::DataFrame &df,
   
   Rcpp::IntegerVector col_strand = res["strand"];;                              // making strand a factor
   col_strand.attr("class") = "factor";
-  col_strand.attr("levels") = strand.attr("levels");
+  if (merge_strands)                                                            // merged strands of symmetric contexts are '*'
+    col_strand.attr("levels") = Rcpp::CharacterVector::create("+","-","*");
+  else
+    col_strand.attr("levels") = strand.attr("levels");
   
   Rcpp::CharacterVector contexts = Rcpp::CharacterVector::create(               // base contexts
     "NA1","CHH","NA3","NA4","NA5","CHG","CG"
@@ -222,7 +225,133 @@ Rcpp::DataFrame rcpp_mhl_report(Rcpp::DataFrame &df,
   col_context.attr("class") = "factor";
   col_context.attr("levels") = contexts;
   
-  free(num_buf);                                                                // free manually allocated memory
+  return res;
+}
+
+
+// Region-level (BED) lMHL report
+// PRE-SORTED DATASET IS A REQUIREMENT.
+// 
+// Calculates lMHL for every BED region at the level of haplotypes, which are
+// clipped to region boundaries first: for every read (read pair) overlapping
+// a region, haplotype is made of within-context bases inside the region. lMHL
+// numerator is a sum of nrS() of every methylated stretch of such haplotype,
+// denominator is nrS() of haplotype size. Both are taken from the same lookup
+// table as in per-cytosine report, i.e., stretches longer than hmax are capped
+// at nrS(hmax). Strands are not distinguished.
+// Output report is a data.frame with three columns and rows for every region
+// in original BED order: nreads, length, lmhl
+// 
+// 1) regions are processed in parallel, reads overlapping every region are
+//    found by binary search within [region start - max read length, region end]
+// 2) reads are filtered (hmin, max_ooctx_meth_frac) using full haplotype, as in
+//    per-cytosine report
+// 
+
+// [[Rcpp::export]]
+Rcpp::DataFrame rcpp_mhl_bed_report(Rcpp::DataFrame &df,                        // data frame with BAM data
+                                    Rcpp::DataFrame &bed,                       // BED data
+                                    const std::string ctx,                      // context string for bases to report,
+                                    const int hmax,                             // maximum length of a computation window (limit for l in lMHL formula)
+                                    const int hmin,                             // ignore haplotypes smaller than hmin
+                                    const double max_ooctx_meth_frac,           // maximum fraction of methylated to total out-of-context bases (max out-of-context beta value)
+                                    const int nthreads)                         // number of OpenMP threads
+{
+  Rcpp::IntegerVector rname   = df["rname"];                                    // template rname
+  Rcpp::IntegerVector start   = df["start"];                                    // template start
+  Rcpp::IntegerVector templid = df["templid"];                                  // template id, effectively holds indexes of corresponding std::string in std::vector
+  
+  Rcpp::XPtr<std::vector<std::string>> seqxm((SEXP)df.attr("seqxm_xptr"));      // merged refspaced packed template SEQXMs, as a pointer to std::vector<std::string>
+  
+  const ctx_hist_view ctxhist(df, *seqxm, nthreads);                            // per-template context histograms
+  
+  Rcpp::IntegerVector reg_chr   = bed["seqnames"];                              // BED rname
+  Rcpp::IntegerVector reg_start = bed["start"];                                 // BED start
+  Rcpp::IntegerVector reg_end   = bed["end"];                                   // BED end
+  
+  // array of contexts to include
+  unsigned int ctx_map [16] = {0};
+  std::for_each(ctx.begin(), ctx.end(), [&ctx_map] (unsigned int const &c) {
+    ctx_map[ctx_to_idx(c)]=1;
+  });
+  
+  // precomputed lMHL numerator lookup table, shared between calls and with
+  // per-cytosine report
+  const uint64_t *mhl_lookup = get_mhl_lookup(hmax);
+  
+  // raw pointers to be used within threads
+  const int *rname_ptr = rname.begin(), *start_ptr = start.begin(), *templid_ptr = templid.begin();
+  const int *reg_chr_ptr = reg_chr.begin(), *reg_start_ptr = reg_start.begin(), *reg_end_ptr = reg_end.begin();
+  const std::vector<std::string> &seqxm_ref = *seqxm;
+  const size_t nreads = rname.size();
+  const int nregions = reg_start.size();
+  
+  // longest read tells how far before the region start the overlapping reads may begin
+  long long max_size = 0;
+  for (size_t x=0; x<nreads; x++)
+    max_size = std::max(max_size, (long long)seqxm->at(templid_ptr[x]).size());
+  
+  // result
+  std::vector<int> res_nreads (nregions, 0);
+  std::vector<uint64_t> res_hlen (nregions, 0), res_numer (nregions, 0), res_denom (nregions, 0);
+  
+  // regions in parallel
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads)
+  for (int r=0; r<nregions; r++) {
+    if (reg_chr_ptr[r]==NA_INTEGER) continue;                                   // rname is not in BAM
+    const size_t first = first_read(rname_ptr, start_ptr, nreads, reg_chr_ptr[r], (long long)reg_start_ptr[r] - max_size + 1);
+    const size_t last = first_read(rname_ptr, start_ptr, nreads, reg_chr_ptr[r], (long long)reg_end_ptr[r] + 1);
+    for (size_t x=first; x<last; x++) {
+      const int start_x = start_ptr[x];                                         // start of the current read
+      const char* seqxm_x = seqxm_ref[templid_ptr[x]].c_str();                  // seqxm[templid[x]] is a reference to a corresponding SEQXM string
+      const int size_x = seqxm_ref[templid_ptr[x]].size();                      // length of the current read
+      const int end_x = start_x + size_x - 1;                                   // end of the current read
+      if (end_x<reg_start_ptr[r]) continue;                                     // ends before the region
+      
+      // read-level filtering, exactly as in per-cytosine report
+      size_t h_size;                                                            // total size of haplotype
+      double ooctx_meth_frac;                                                   // fraction of o-o-ctx methylated
+      get_hap_stats(ctxhist[templid_ptr[x]], ctx_map, h_size, ooctx_meth_frac);
+      if ((int)h_size<hmin || ooctx_meth_frac>max_ooctx_meth_frac) continue;    // skip read if haplotype is smaller than hmin or too many o-o-ctx meth bases
+      
+      // decomposition of the haplotype clipped to the region
+      const int from = std::max(start_x, reg_start_ptr[r]) - start_x;           // first base of the read within region
+      const int to = std::min(end_x, reg_end_ptr[r]) - start_x;                 // last base of the read within region
+      size_t h_clip = 0, mh_size = 0;                                           // size of clipped haplotype and current methylated stretch
+      uint64_t numer = 0;                                                       // lMHL numerator
+      for (int i=from; i<=to; i++) {
+        const unsigned int base_idx = unpack_ctx_idx(seqxm_x[i]);
+        if (ctx_map[base_idx]) {                                                // if within context
+          h_clip++;
+          if (base_idx<8) {                                                     // if uppercase (methylated stretch started/continues)
+            mh_size++;
+          } else if (mh_size) {                                                 // if lowercase and after non-0-length methylated stretch
+            numer += mhl_lookup[std::min(mh_size, MHL_LOOKUP_LEN-1)];           // all fully methylated sub-stretches of methylated stretch
+            mh_size = 0;
+          }
+        }
+      }
+      if (!h_clip) continue;                                                    // no context bases within region
+      numer += mhl_lookup[std::min(mh_size, MHL_LOOKUP_LEN-1)];                 // last methylated stretch, if any
+      res_nreads[r]++;
+      res_hlen[r]  += h_clip;
+      res_numer[r] += numer;
+      res_denom[r] += mhl_lookup[std::min(h_clip, MHL_LOOKUP_LEN-1)];           // all sub-stretches of haplotype
+    }
+  }
+  
+  std::vector<double> res_length (nregions, NA_REAL), res_mhl (nregions, NA_REAL);
+  for (int r=0; r<nregions; r++) {
+    if (!res_nreads[r]) continue;
+    res_length[r] = (double)res_hlen[r]/res_nreads[r];                          // average haplotype size within region
+    res_mhl[r] = (double)res_numer[r]/res_denom[r];                             // lMHL
+  }
+  
+  Rcpp::DataFrame res = Rcpp::DataFrame::create(                                // final region lMHL report
+    Rcpp::Named("nreads") = res_nreads,                                         // number of reads with context bases within region
+    Rcpp::Named("length") = res_length,                                         // average haplotype length within region
+    Rcpp::Named("lmhl") = res_mhl                                               // lMHL value
+  );
   
   return res;
 }
@@ -262,8 +391,8 @@ sapply(1:30, nrS)
 microbenchmark::microbenchmark(sapply(1:200, S), sapply(1:200, nrS))
 
 ### lMHL calculations for a stretch of n mCpGs over a window of k.
-### The following is not used, as it doesn't provide proper granularity for
-### long-range sequencing
+### The following is used for region-level lMHL only, as it doesn't provide proper
+### per-cytosine granularity for long-range sequencing
 #
 # for mCpG stretches of length n, sum S of all possible lMHL combinations
 # (of length i from 1 to k [where k<n], times i) equals to:
@@ -43,12 +43,13 @@ Rcpp::DataFrame rcpp_read_bam_paired (std::string fn,
   
   // main containers
   std::vector<std::string>* seqxm = new std::vector<std::string>;               // SEQXM, leftmost 4 bits are SEQ and rightmost 4 are XM
+  std::vector<T_ctx_hist>* ctxhist = new std::vector<T_ctx_hist>;              // per-template histograms of XM context indices
   std::vector<int> rname, strand, start;                                        // id for RNAME, id for CT==1/GA==2, POS
   int nrecs = 0, ntempls = 0;                                                   // counters: BAM records, templates (consecutive proper read pairs)
   
   // reserve some memory
   rname.reserve(0xFFFFF); strand.reserve(0xFFFFF); start.reserve(0xFFFFF); 
-  seqxm->reserve(0xFFFFF);
+  seqxm->reserve(0xFFFFF); ctxhist->reserve(0xFFFFF);
   
   // template holders
   char *templ_qname = (char*) malloc(max_qname_width * sizeof(char));           // template QNAME
@@ -63,6 +64,7 @@ Rcpp::DataFrame rcpp_read_bam_paired (std::string fn,
     strand.push_back(templ_strand);                                                        /* STRAND */ \
     start.push_back(templ_start + trim5 + 1);                                               /* POS+1 */ \
     seqxm->emplace_back((const char*) templ_seqxm_rs + trim5, templ_width - (trim5+trim3)); /* SEQXM */ \
+    ctxhist->push_back(get_ctx_hist(seqxm->back()));                                 /* XM histogram */ \
     std::memset(templ_qual_rs, (uint8_t) min_baseq, templ_width); /* fill QUAL holder with min_baseq */ \
     std::memset(templ_seqxm_rs, 0b11111011, templ_width);     /* fill SEQXM with 'N-', i.e., '15,11' */ \
     ntempls++;                                                                                 /* +1 */ \
@@ -184,6 +186,8 @@ Rcpp::DataFrame rcpp_read_bam_paired (std::string fn,
   
   Rcpp::XPtr<std::vector<std::string>> seqxm_xptr(seqxm, true);
   res.attr("seqxm_xptr") = seqxm_xptr;                                          // external pointer to packed sequences + methylation strings
+  Rcpp::XPtr<std::vector<T_ctx_hist>> ctxhist_xptr(ctxhist, true);
+  res.attr("ctxhist_xptr") = ctxhist_xptr;                                      // external pointer to per-template context histograms
   
   res.attr("nrecs") = nrecs;                                                    // number of records in BAM file
   res.attr("npushed") = ntempls;                                                // number of templates pushed to data.frame
@@ -221,12 +225,13 @@ Rcpp::DataFrame rcpp_read_bam_single (std::string fn,
   
   // main containers
   std::vector<std::string>* seqxm = new std::vector<std::string>;               // SEQXM, leftmost 4 bits are SEQ and rightmost 4 are XM
+  std::vector<T_ctx_hist>* ctxhist = new std::vector<T_ctx_hist>;              // per-template histograms of XM context indices
   std::vector<int> rname, strand, start;                                        // id for RNAME, id for CT==1/GA==2, POS
   int nrecs = 0, npushed = 0;                                                   // counters: BAM records read, BAM records pushed to data.table
   
   // reserve some memory
   rname.reserve(0xFFFFF); strand.reserve(0xFFFFF); start.reserve(0xFFFFF); 
-  seqxm->reserve(0xFFFFF);
+  seqxm->reserve(0xFFFFF); ctxhist->reserve(0xFFFFF);
   
   // read holders
   int record_width = max_record_width;                                          // record ISIZE/TLEN
@@ -304,6 +309,7 @@ Rcpp::DataFrame rcpp_read_bam_single (std::string fn,
     strand.push_back(( record_strand[1] == 'C' ) ? 1 : 2);                      // STRAND is 1 if "ZCT"/"+", 2 if "ZGA"/"-"
     start.push_back(bam_rec->core.pos + trim5 +1);                              // POS+1 
     seqxm->emplace_back((const char*) record_seqxm_rs + trim5, dest_pos - (trim5+trim3)); // SEQXM
+    ctxhist->push_back(get_ctx_hist(seqxm->back()));                            // XM histogram
     npushed++;                                                                  // +1 
   }
   
@@ -335,6 +341,8 @@ Rcpp::DataFrame rcpp_read_bam_single (std::string fn,
   
   Rcpp::XPtr<std::vector<std::string>> seqxm_xptr(seqxm, true);
   res.attr("seqxm_xptr") = seqxm_xptr;                                          // external pointer to packed sequences + methylation strings
+  Rcpp::XPtr<std::vector<T_ctx_hist>> ctxhist_xptr(ctxhist, true);
+  res.attr("ctxhist_xptr") = ctxhist_xptr;                                      // external pointer to per-template context histograms
   
   res.attr("nrecs") = nrecs;                                                    // number of records in BAM file
   res.attr("npushed") = npushed;                                                // number of records pushed to data.frame
@@ -395,12 +403,13 @@ Rcpp::DataFrame rcpp_read_bam_mm_single (std::string fn,
 
   // main containers
   std::vector<std::string>* seqxm = new std::vector<std::string>;               // SEQXM, leftmost 4 bits are SEQ and rightmost 4 are XM
+  std::vector<T_ctx_hist>* ctxhist = new std::vector<T_ctx_hist>;              // per-template histograms of XM context indices
   std::vector<int> rname, strand, start;                                        // id for RNAME, id for CT==1/GA==2, POS
   int nrecs = 0, npushed = 0;                                                   // counters: BAM records read, BAM records pushed to data.table
 
   // reserve some memory
   rname.reserve(0xFFFFF); strand.reserve(0xFFFFF); start.reserve(0xFFFFF);
-  seqxm->reserve(0xFFFFF);
+  seqxm->reserve(0xFFFFF); ctxhist->reserve(0xFFFFF);
 
   // read holders
   int query_width = max_query_width;                                            // NON-refspaced query length
@@ -535,6 +544,7 @@ Rcpp::DataFrame rcpp_read_bam_mm_single (std::string fn,
         strand.push_back(s + 1);                                                // STRAND is 1 if "CT"/"+", 2 if "GA"/"-"
         start.push_back(bam_rec->core.pos + trim5 + 1);                         // POS+1
         seqxm->emplace_back( (const char*) record_seqxm_rs[s] + trim5, dest_pos - (trim5+trim3)); // SEQXM
+        ctxhist->push_back(get_ctx_hist(seqxm->back()));                        // XM histogram
         npushed++;                                                              // +1
       }
     }
@@ -571,6 +581,8 @@ Rcpp::DataFrame rcpp_read_bam_mm_single (std::string fn,
 
   Rcpp::XPtr<std::vector<std::string>> seqxm_xptr(seqxm, true);
   res.attr("seqxm_xptr") = seqxm_xptr;                                          // external pointer to sequences
+  Rcpp::XPtr<std::vector<T_ctx_hist>> ctxhist_xptr(ctxhist, true);
+  res.attr("ctxhist_xptr") = ctxhist_xptr;                                      // external pointer to per-template context histograms
 
   res.attr("nrecs") = nrecs;                                                    // number of records in BAM file
   res.attr("npushed") = npushed;                                                // number of records pushed to data.frame
@@ -0,0 +1,126 @@
+#include <Rcpp.h>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <htslib/hts.h>
+#include <htslib/vcf.h>
+#include <htslib/synced_bcf_reader.h>
+
+// [[Rcpp::plugins(cpp17)]]
+// [[Rcpp::depends(Rhtslib)]]
+
+// Reads single-nucleotide variations from VCF/BCF file.
+// Takes as an input (optionally bgzipped) VCF or BCF (by means of HTSlib).
+// If regions are given, file must be indexed, and only records overlapping
+// these regions are read.
+//
+// Only the records on given reference sequences (i.e., the ones of
+// preprocessed BAM) are taken. Among them, only the ones with single-base REF
+// allele are reported, once for every single-base ALT allele (i.e.,
+// multiallelic records are split into biallelic ones). Genotypes and INFO are
+// never parsed.
+//
+// Returns a list with:
+// 1) field "name"     - variation identifier, or "rname:pos_REF/ALT" if absent
+// 2) field "seqnames" - 1-based index of reference sequence in rnames
+// 3) field "start"    - 1-based position
+// 4) field "REF"      - REF allele
+// 5) field "ALT"      - ALT allele
+
+// [[Rcpp::export]]
+Rcpp::List rcpp_read_vcf (std::string fn,                                       // input: a name of VCF/BCF file
+                          std::vector<std::string> rnames,                      // names of reference sequences as they are in VCF
+                          std::vector<std::string> regions,                     // "rname:start-end" regions to read
+                          bool use_regions,                                     // read only regions, or the entire file
+                          int nthreads)                                         // HTSlib threads, >0 for multiple
+{
+  // containers
+  std::vector<std::string> name, ref, alt;
+  std::vector<int> seqnames, start;
+  
+  // reference sequence names to their indices
+  std::unordered_map<std::string,int> rname_idx;
+  for (size_t i=0; i<rnames.size(); i++) rname_idx.emplace(rnames[i], i+1);
+  
+  if (use_regions && regions.empty())                                           // nothing to read
+    return Rcpp::List::create(
+      Rcpp::Named("name") = name, Rcpp::Named("seqnames") = seqnames,
+      Rcpp::Named("start") = start, Rcpp::Named("REF") = ref,
+      Rcpp::Named("ALT") = alt
+    );
+  
+  // file IO
+  std::unique_ptr<bcf_srs_t, decltype(&bcf_sr_destroy)>                         // synced reader handles both VCF and BCF, and their indices;
+    sr_guard(bcf_sr_init(), &bcf_sr_destroy);                                   // destroyed on any exit, incl. Rcpp::stop and user interrupt
+  bcf_srs_t *sr = sr_guard.get();
+  if (!sr) Rcpp::stop("Unable to initialise VCF reader");
+  if (use_regions) {
+    std::string regions_str;
+    for (size_t i=0; i<regions.size(); i++) regions_str += (i ? "," : "") + regions[i];
+    if (bcf_sr_set_regions(sr, regions_str.c_str(), 0)<0)
+      Rcpp::stop("Unable to set VCF regions");
+  }
+  bcf_sr_set_samples(sr, "-", 0);                                               // no samples, no genotypes
+  if (nthreads>0) bcf_sr_set_threads(sr, nthreads);
+  if (!bcf_sr_add_reader(sr, fn.c_str()))
+    Rcpp::stop("Unable to open VCF file for reading: " +                        // fall back if error
+               std::string(bcf_sr_strerror(sr->errnum)));
+  const bcf_hdr_t *hdr = bcf_sr_get_header(sr, 0);
+  
+  std::vector<int> rid_idx (hdr->n[BCF_DT_CTG], -1);                            // VCF rid to rname index, 0 if not in rnames, -1 if not yet known
+  uint64_t nrecs = 0;
+  while (bcf_sr_next_line(sr)) {
+    // checking for the interrupt
+    if ((++nrecs & 0xFFFFF) == 0) Rcpp::checkUserInterrupt();
+    
+    bcf1_t *rec = bcf_sr_get_line(sr, 0);
+    if (rec->rid<0 || rec->rid>=(int)rid_idx.size()) continue;
+    int &idx = rid_idx[rec->rid];
+    if (idx<0) {
+      const auto found = rname_idx.find(bcf_hdr_id2name(hdr, rec->rid));
+      idx = found==rname_idx.end() ? 0 : found->second;
+    }
+    if (idx==0) continue;                                                       // not on given reference sequences
+    if (rec->rlen!=1) continue;                                                 // REF is not a single base
+    
+    bcf_unpack(rec, BCF_UN_STR);                                                // ID, REF and ALT only
+    const char *rec_ref = rec->d.allele[0];
+    if (std::strlen(rec_ref)!=1) continue;
+    for (unsigned int a=1; a<rec->n_allele; a++) {
+      const char *rec_alt = rec->d.allele[a];
+      if (std::strlen(rec_alt)!=1 || rec_alt[0]=='.' || rec_alt[0]=='*') continue; // not a single base
+      if (std::strcmp(rec->d.id, ".")==0) {
+        name.push_back(rnames[idx-1] + ":" + std::to_string(rec->pos+1) + "_" + rec_ref + "/" + rec_alt);
+      } else {
+        name.push_back(rec->d.id);
+      }
+      seqnames.push_back(idx);
+      start.push_back(rec->pos+1);
+      ref.push_back(rec_ref);
+      alt.push_back(rec_alt);
+    }
+  }
+  
+  sr_guard.reset();                                                             // close VCF file
+  
+  return Rcpp::List::create(
+    Rcpp::Named("name") = name, Rcpp::Named("seqnames") = seqnames,
+    Rcpp::Named("start") = start, Rcpp::Named("REF") = ref,
+    Rcpp::Named("ALT") = alt
+  );
+}
+
+
+// test code in R
+//
+
+/*** R
+vcf <- rcpp_read_vcf(system.file("extdata", "capture.vcf.gz", package="epialleleR"),
+                     paste0("chr", c(1:22, "X", "Y")), character(0), FALSE, 0)
+# microbenchmark::microbenchmark(rcpp_read_vcf("dbsnp.vcf.gz", paste0("chr", c(1:22, "X", "Y")), character(0), FALSE, 0), times=1)
+*/
+
+// Sourcing:
+// Rcpp::sourceCpp("rcpp_read_vcf.cpp")
+
+// #############################################################################